@@ -0,0 +1,202 @@
+/***************************************************************************
+ *   Copyright 2011 Stefan Majewsky <majewsky@gmx.net>                     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "alphamask_p.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+#include <QtCore/qmath.h>
+#include <QtGui/QImage>
+#include <QtGui/QPolygonF>
+
+Tagaro::AlphaMask::AlphaMask(const QImage& image, int threshold)
+	: d(createData(image, threshold))
+{
+	if (d)
+	{
+		d->build();
+		d->traceShape();
+	}
+}
+
+Tagaro::AlphaMask Tagaro::AlphaMask::deferred(const QImage& image, int threshold)
+{
+	Tagaro::AlphaMask mask;
+	mask.d = createData(image, threshold);
+	return mask;
+}
+
+Tagaro::AlphaMask::Data* Tagaro::AlphaMask::createData(const QImage& image, int threshold)
+{
+	if (threshold <= 0 || image.isNull() || !image.hasAlphaChannel())
+	{
+		return 0;
+	}
+	Tagaro::AlphaMask::Data* data = new Tagaro::AlphaMask::Data;
+	data->m_size = image.size();
+	data->m_image = image; //shallow copy
+	data->m_threshold = threshold;
+	return data;
+}
+
+void Tagaro::AlphaMask::Data::build()
+{
+	//both formats have the alpha value in the same place
+	QImage argbImage = m_image;
+	m_image = QImage();
+	if (argbImage.format() != QImage::Format_ARGB32 && argbImage.format() != QImage::Format_ARGB32_Premultiplied)
+	{
+		argbImage = argbImage.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+	}
+	const int width = m_size.width(), height = m_size.height();
+	m_bits.resize(width * height);
+	for (int y = 0; y < height; ++y)
+	{
+		const QRgb* line = reinterpret_cast<const QRgb*>(argbImage.constScanLine(y));
+		const int offset = y * width;
+		for (int x = 0; x < width; ++x)
+		{
+			if (qAlpha(line[x]) >= m_threshold)
+			{
+				m_bits.setBit(offset + x);
+			}
+		}
+	}
+}
+
+const qreal Tagaro::AlphaMask::ShapeTolerance = 1.0;
+
+//Douglas-Peucker simplification of the open polyline points[first..last]. The
+//end points are always kept; the kept points in between are appended to result.
+static void simplifyPolyline(const QVector<QPointF>& points, int first, int last, QPolygonF& result)
+{
+	if (last - first < 2)
+	{
+		return;
+	}
+	const QPointF a = points[first], b = points[last];
+	const QPointF ab = b - a;
+	const qreal length = qSqrt(ab.x() * ab.x() + ab.y() * ab.y());
+	int farthest = -1;
+	qreal maxDistance = Tagaro::AlphaMask::ShapeTolerance;
+	for (int i = first + 1; i < last; ++i)
+	{
+		const QPointF ap = points[i] - a;
+		//distance from the line through a and b (or from a if a == b)
+		const qreal distance = length > 0
+			? qAbs(ab.x() * ap.y() - ab.y() * ap.x()) / length
+			: qSqrt(ap.x() * ap.x() + ap.y() * ap.y());
+		if (distance > maxDistance)
+		{
+			maxDistance = distance;
+			farthest = i;
+		}
+	}
+	if (farthest >= 0)
+	{
+		simplifyPolyline(points, first, farthest, result);
+		result << points[farthest];
+		simplifyPolyline(points, farthest, last, result);
+	}
+}
+
+void Tagaro::AlphaMask::Data::traceShape()
+{
+	//Every border between an opaque and a transparent pixel is an edge between
+	//two pixel corners. The edges are directed such that the opaque pixel is on
+	//the right (in a coordinate system with the y axis pointing down), so the
+	//outer contours run clockwise, and holes run counter-clockwise. Corners
+	//where two opaque pixels touch diagonally have two outgoing edges; the
+	//winding number does not depend on how the contours are joined there.
+	//Only corners on the border are stored, so the memory usage depends on
+	//the length of the outline instead of the size of the image.
+	m_traced = true;
+	const int width = m_size.width(), height = m_size.height();
+	const int stride = width + 1;
+	QMultiHash<int, int> edges;
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			if (!testPixel(x, y))
+			{
+				continue;
+			}
+			const int topLeft = y * stride + x, topRight = topLeft + 1;
+			const int bottomLeft = topLeft + stride, bottomRight = bottomLeft + 1;
+			if (!testPixel(x, y - 1))
+				edges.insert(topLeft, topRight);
+			if (!testPixel(x + 1, y))
+				edges.insert(topRight, bottomRight);
+			if (!testPixel(x, y + 1))
+				edges.insert(bottomRight, bottomLeft);
+			if (!testPixel(x - 1, y))
+				edges.insert(bottomLeft, topLeft);
+		}
+	}
+	//follow the edges into closed contours
+	m_shape.setFillRule(Qt::WindingFill);
+	while (!edges.isEmpty())
+	{
+		//collect the corners where the direction changes (every corner
+		//has as many incoming as outgoing edges, so the walk always
+		//returns to the start)
+		const int start = edges.constBegin().key();
+		QVector<QPointF> corners;
+		int current = start, previousStep = 0;
+		do
+		{
+			const QMultiHash<int, int>::iterator it = edges.find(current);
+			const int next = it.value();
+			edges.erase(it);
+			const int step = next - current;
+			if (step != previousStep)
+			{
+				corners << QPointF(current % stride, current / stride);
+				previousStep = step;
+			}
+			current = next;
+		}
+		while (current != start);
+		//simplify the closed contour by splitting it at the corner which is
+		//farthest from the first corner
+		int farthest = 0;
+		qreal maxDistance = -1;
+		for (int i = 1; i < corners.count(); ++i)
+		{
+			const QPointF d = corners[i] - corners[0];
+			const qreal distance = d.x() * d.x() + d.y() * d.y();
+			if (distance > maxDistance)
+			{
+				maxDistance = distance;
+				farthest = i;
+			}
+		}
+		corners << corners[0];
+		QPolygonF polygon;
+		polygon << corners[0];
+		simplifyPolyline(corners, 0, farthest, polygon);
+		polygon << corners[farthest];
+		simplifyPolyline(corners, farthest, corners.count() - 1, polygon);
+		if (polygon.count() >= 3)
+		{
+			m_shape.addPolygon(polygon);
+			m_shape.closeSubpath();
+		}
+	}
+}
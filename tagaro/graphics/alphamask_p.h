@@ -0,0 +1,113 @@
+/***************************************************************************
+ *   Copyright 2011 Stefan Majewsky <majewsky@gmx.net>                     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef TAGARO_ALPHAMASK_P_H
+#define TAGARO_ALPHAMASK_P_H
+
+#include <QtCore/QBitArray>
+#include <QtCore/QSharedData>
+#include <QtCore/QSize>
+#include <QtGui/QImage>
+#include <QtGui/QPainterPath>
+
+namespace Tagaro {
+
+//A 1-bit version of the alpha channel of a rendered image, which is used for
+//hit tests instead of reading back single pixels from the pixmap. A pixel is
+//opaque if its alpha value reaches the threshold from
+//Tagaro::GraphicsSourceConfig::alphaThreshold(). Masks are built by the
+//rendering threads along with the images, and are explicitly shared between
+//all clients showing the same frame.
+//
+//Images which do not come from the rendering threads (e.g. disk cache hits in
+//the GUI thread) get deferred masks, which are only built when they are used
+//for the first time. Deferred masks must only be used in the GUI thread.
+//
+//The outline of the opaque pixels is used as the shape of the clients for
+//collision detection. It is traced by the rendering threads along with the
+//mask, but only on demand for deferred masks.
+class AlphaMask
+{
+	public:
+		//Creates a null mask, in which all pixels are opaque.
+		AlphaMask() {}
+		//Builds the mask and traces its outline right away. If the image has
+		//no alpha channel, or if the threshold is not positive, this creates
+		//a null mask.
+		AlphaMask(const QImage& image, int threshold);
+		//Like the constructor, but the mask is built on the first hit test,
+		//and the outline is traced on the first call to shape().
+		static Tagaro::AlphaMask deferred(const QImage& image, int threshold);
+
+		inline bool isNull() const { return !d; }
+		inline QSize size() const { return d ? d->m_size : QSize(); }
+		//Returns whether the given pixel is opaque. Pixels outside the mask
+		//are never opaque, except if the mask is null.
+		inline bool testPixel(int x, int y) const
+		{
+			if (!d)
+				return true;
+			if (x < 0 || y < 0 || x >= d->m_size.width() || y >= d->m_size.height())
+				return false;
+			d->ensureBuilt();
+			return d->m_bits.testBit(y * d->m_size.width() + x);
+		}
+		//Returns the outline of the opaque pixels (in pixel coordinates),
+		//simplified such that it deviates by at most ShapeTolerance pixels
+		//from the exact pixel outline. Returns an empty path for null masks.
+		inline QPainterPath shape() const
+		{
+			if (!d)
+				return QPainterPath();
+			d->ensureBuilt();
+			d->ensureTraced();
+			return d->m_shape;
+		}
+		static const qreal ShapeTolerance;
+	private:
+		struct Data : public QSharedData
+		{
+			QSize m_size;
+			QBitArray m_bits;
+			QPainterPath m_shape;
+			//the source of a deferred mask, until it is built
+			QImage m_image;
+			int m_threshold;
+			bool m_traced;
+
+			Data() : m_traced(false) {}
+			inline void ensureBuilt() { if (!m_image.isNull()) build(); }
+			inline void ensureTraced() { if (!m_traced) traceShape(); }
+			void build();
+			inline bool testPixel(int x, int y) const
+			{
+				if (x < 0 || y < 0 || x >= m_size.width() || y >= m_size.height())
+					return false;
+				return m_bits.testBit(y * m_size.width() + x);
+			}
+			void traceShape();
+		};
+		//Returns 0 if the mask would be null.
+		static Tagaro::AlphaMask::Data* createData(const QImage& image, int threshold);
+
+		QExplicitlySharedDataPointer<Tagaro::AlphaMask::Data> d;
+};
+
+} //namespace Tagaro
+
+#endif // TAGARO_ALPHAMASK_P_H
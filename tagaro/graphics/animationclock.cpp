@@ -0,0 +1,281 @@
+/***************************************************************************
+ *   Copyright 2011 Stefan Majewsky <majewsky@gmx.net>                     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "animationclock.h"
+#include "animationclock_p.h"
+#include "sprite.h"
+#include "spriteclient.h"
+
+#include <QtCore/QTimerEvent>
+#include <QtCore/qmath.h>
+#include <KDE/KGlobal>
+
+K_GLOBAL_STATIC(Tagaro::AnimationTimer, g_animationTimer)
+
+//tolerance for rounding errors when the phase is exactly at a frame boundary
+static const qreal g_phaseEpsilon = 1e-6;
+
+//BEGIN Tagaro::AnimationClock
+
+int Tagaro::AnimationClock::tickInterval()
+{
+	return g_animationTimer->tickInterval();
+}
+
+void Tagaro::AnimationClock::setTickInterval(int tickInterval)
+{
+	g_animationTimer->setTickInterval(tickInterval);
+}
+
+bool Tagaro::AnimationClock::isPaused()
+{
+	return g_animationTimer->isPaused();
+}
+
+void Tagaro::AnimationClock::setPaused(bool paused)
+{
+	g_animationTimer->setPaused(paused);
+}
+
+//END Tagaro::AnimationClock
+//BEGIN Tagaro::AnimationTimer
+
+Tagaro::AnimationTimer::AnimationTimer()
+	: m_activeCount(0)
+	, m_lastTime(0)
+	, m_tickInterval(16)
+	, m_paused(false)
+	, m_delivering(false)
+{
+	m_clock.start();
+}
+
+Tagaro::AnimationTimer* Tagaro::AnimationTimer::instance()
+{
+	//may be called from destructors during shutdown
+	return g_animationTimer.isDestroyed() ? 0 : static_cast<Tagaro::AnimationTimer*>(g_animationTimer);
+}
+
+int Tagaro::AnimationTimer::tickInterval() const
+{
+	return m_tickInterval;
+}
+
+void Tagaro::AnimationTimer::setTickInterval(int tickInterval)
+{
+	tickInterval = qMax(1, tickInterval);
+	if (m_tickInterval != tickInterval)
+	{
+		m_tickInterval = tickInterval;
+		schedule();
+	}
+}
+
+bool Tagaro::AnimationTimer::isPaused() const
+{
+	return m_paused;
+}
+
+void Tagaro::AnimationTimer::setPaused(bool paused)
+{
+	if (m_paused != paused)
+	{
+		advance();
+		m_paused = paused;
+		schedule();
+	}
+}
+
+void Tagaro::AnimationTimer::setSpeed(Tagaro::SpriteClient* client, qreal speed)
+{
+	advance();
+	QHash<Tagaro::SpriteClient*, Animation>::iterator it = m_animations.find(client);
+	if (speed == 0)
+	{
+		if (it != m_animations.end())
+		{
+			if (it->active)
+			{
+				--m_activeCount;
+			}
+			m_animations.erase(it);
+		}
+	}
+	else if (it != m_animations.end())
+	{
+		it->speed = speed;
+	}
+	else
+	{
+		const Animation animation = { speed, qMax(0, client->frame()), client->renderPriority() != Tagaro::RenderScheduler::WarmupPriority };
+		m_animations.insert(client, animation);
+		if (animation.active)
+		{
+			++m_activeCount;
+		}
+	}
+	schedule();
+}
+
+void Tagaro::AnimationTimer::setFrame(Tagaro::SpriteClient* client, int frame)
+{
+	if (m_delivering)
+	{
+		return;
+	}
+	QHash<Tagaro::SpriteClient*, Animation>::iterator it = m_animations.find(client);
+	if (it != m_animations.end())
+	{
+		//continue the animation from the new frame
+		advance();
+		it->phase = frame;
+		schedule();
+	}
+}
+
+void Tagaro::AnimationTimer::setActive(Tagaro::SpriteClient* client, bool active)
+{
+	QHash<Tagaro::SpriteClient*, Animation>::iterator it = m_animations.find(client);
+	if (it == m_animations.end() || it->active == active)
+	{
+		return;
+	}
+	advance();
+	it->active = active;
+	m_activeCount += active ? 1 : -1;
+	schedule();
+}
+
+int Tagaro::AnimationTimer::currentFrame(const Animation& animation, int frameCount)
+{
+	//When running backwards, the frame changes when the phase drops below an
+	//integer, not when it reaches the next lower integer.
+	int frame = animation.speed > 0 ? qFloor(animation.phase + g_phaseEpsilon) : qCeil(animation.phase - g_phaseEpsilon);
+	if (frameCount > 0)
+	{
+		frame %= frameCount;
+	}
+	return frame;
+}
+
+void Tagaro::AnimationTimer::advance()
+{
+	const qint64 now = m_clock.elapsed();
+	const qreal seconds = qreal(now - m_lastTime) / 1000;
+	m_lastTime = now;
+	if (m_paused || seconds <= 0)
+	{
+		return;
+	}
+	QHash<Tagaro::SpriteClient*, Animation>::iterator it = m_animations.begin(), end = m_animations.end();
+	for (; it != end; ++it)
+	{
+		if (!it->active)
+		{
+			continue;
+		}
+		it->phase += it->speed * seconds;
+		//keep the phase small to avoid precision loss in long-running games
+		Tagaro::Sprite* sprite = it.key()->sprite();
+		const int frameCount = sprite ? sprite->frameCount() : 0;
+		if (frameCount > 0)
+		{
+			it->phase = fmod(it->phase, qreal(frameCount));
+			if (it->phase < 0)
+			{
+				it->phase += frameCount;
+			}
+		}
+	}
+}
+
+void Tagaro::AnimationTimer::schedule()
+{
+	if (m_paused || m_activeCount == 0)
+	{
+		m_timer.stop();
+		return;
+	}
+	//find the next frame change of any animation
+	qreal wait = -1; //in milliseconds
+	foreach (const Animation& animation, m_animations)
+	{
+		if (!animation.active)
+		{
+			continue;
+		}
+		const qreal fraction = animation.phase - qFloor(animation.phase);
+		qreal distance = animation.speed > 0 ? 1 - fraction : fraction;
+		if (distance < g_phaseEpsilon)
+		{
+			distance = 1;
+		}
+		const qreal animationWait = distance / qAbs(animation.speed) * 1000;
+		if (wait < 0 || animationWait < wait)
+		{
+			wait = animationWait;
+		}
+	}
+	//align the tick to the grid, so that ticks are shared between animations
+	const qint64 due = m_lastTime + qCeil(wait);
+	const qint64 tick = (due + m_tickInterval - 1) / m_tickInterval * m_tickInterval;
+	const qint64 interval = tick - m_clock.elapsed();
+	m_timer.start(qMax(qint64(0), interval), this);
+}
+
+void Tagaro::AnimationTimer::timerEvent(QTimerEvent* event)
+{
+	if (event->timerId() != m_timer.timerId())
+	{
+		QObject::timerEvent(event);
+		return;
+	}
+	advance();
+	//collect all frame changes first, because clients may start or stop
+	//animations while they receive their new pixmaps
+	QList<QPair<Tagaro::SpriteClient*, int> > changes;
+	QHash<Tagaro::SpriteClient*, Animation>::const_iterator it = m_animations.constBegin(), end = m_animations.constEnd();
+	for (; it != end; ++it)
+	{
+		if (!it->active)
+		{
+			continue;
+		}
+		Tagaro::SpriteClient* client = it.key();
+		Tagaro::Sprite* sprite = client->sprite();
+		const int frame = currentFrame(it.value(), sprite ? sprite->frameCount() : 0);
+		if (client->frame() != frame)
+		{
+			changes << qMakePair(client, frame);
+		}
+	}
+	//deliver them in one pass
+	m_delivering = true;
+	for (int i = 0; i < changes.count(); ++i)
+	{
+		//the client may have been removed by a previous client
+		if (m_animations.contains(changes[i].first))
+		{
+			changes[i].first->setFrame(changes[i].second);
+		}
+	}
+	m_delivering = false;
+	schedule();
+}
+
+//END Tagaro::AnimationTimer
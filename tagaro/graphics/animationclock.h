@@ -0,0 +1,72 @@
+/***************************************************************************
+ *   Copyright 2011 Stefan Majewsky <majewsky@gmx.net>                     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef TAGARO_ANIMATIONCLOCK_H
+#define TAGARO_ANIMATIONCLOCK_H
+
+#include <QtCore/QtGlobal>
+
+#include <libtagaro_export.h>
+
+namespace Tagaro {
+
+/**
+ * @class Tagaro::AnimationClock animationclock.h <Tagaro/AnimationClock>
+ *
+ * This class controls the single timer which plays the animations of
+ * Tagaro::SpriteClient instances (see Tagaro::SpriteClient::setAnimationSpeed).
+ *
+ * Instead of waking up once per animation, the timer only fires when the next
+ * frame change is due for any animation, and all frame changes which are due
+ * at that point are delivered in one pass. Ticks are aligned to a fixed grid
+ * (approximately the display refresh rate by default), so that animations
+ * which run at different speeds still share their ticks.
+ *
+ * Animations of clients which are not shown anywhere (i.e. whose render
+ * priority is Tagaro::RenderScheduler::WarmupPriority, e.g. because the
+ * Tagaro::Scene's main view is hidden) are suspended, and the timer is stopped
+ * completely when no animation is active.
+ *
+ * Because there is only one animation clock, all methods in this class are
+ * static.
+ */
+class TAGARO_EXPORT AnimationClock
+{
+	public:
+		///@return the tick interval (in milliseconds) @see setTickInterval
+		static int tickInterval();
+		///Sets the granularity of the animation clock (default: 16 ms, i.e.
+		///approximately 60 Hz). Frame changes are delivered at multiples of
+		///this interval, so there is no point in using animation speeds above
+		///1000 / tickInterval() frames per second.
+		static void setTickInterval(int tickInterval);
+		///@return whether all animations are paused
+		static bool isPaused();
+		///Pauses or resumes all animations. When the animations are resumed,
+		///they continue where they were paused.
+		static void setPaused(bool paused);
+	private:
+		class Private;
+		//prohibit instantiation etc.
+		AnimationClock();
+		Q_DISABLE_COPY(AnimationClock)
+};
+
+} //namespace Tagaro
+
+#endif // TAGARO_ANIMATIONCLOCK_H
@@ -0,0 +1,85 @@
+/***************************************************************************
+ *   Copyright 2011 Stefan Majewsky <majewsky@gmx.net>                     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef TAGARO_ANIMATIONCLOCK_P_H
+#define TAGARO_ANIMATIONCLOCK_P_H
+
+#include "animationclock.h"
+
+#include <QtCore/QBasicTimer>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+
+namespace Tagaro {
+
+class SpriteClient;
+
+//Drives the animations of all sprite clients. Lives in the GUI thread.
+//
+//Each animation keeps its position as a fractional frame number (the phase).
+//Phases are advanced whenever the timer fires or the set of running
+//animations changes; the frames are only delivered when the timer fires.
+class AnimationTimer : public QObject
+{
+	public:
+		AnimationTimer();
+		//Returns 0 after the timer has been destroyed during shutdown.
+		static Tagaro::AnimationTimer* instance();
+
+		//Starts, changes or stops (if @a speed == 0) the animation of the
+		//given client.
+		void setSpeed(Tagaro::SpriteClient* client, qreal speed);
+		//Called when the frame of an animated client is changed manually.
+		void setFrame(Tagaro::SpriteClient* client, int frame);
+		//Suspends or resumes the animation of the given client.
+		void setActive(Tagaro::SpriteClient* client, bool active);
+
+		int tickInterval() const;
+		void setTickInterval(int tickInterval);
+		bool isPaused() const;
+		void setPaused(bool paused);
+	protected:
+		virtual void timerEvent(QTimerEvent* event);
+	private:
+		struct Animation
+		{
+			qreal speed; //in frames per second
+			qreal phase;
+			bool active;
+		};
+		//the frame which is shown at the current phase
+		static int currentFrame(const Animation& animation, int frameCount);
+		//Advances all active animations to the current time.
+		void advance();
+		//Starts the timer for the next frame change, or stops it.
+		void schedule();
+
+		QHash<Tagaro::SpriteClient*, Animation> m_animations;
+		int m_activeCount;
+		QBasicTimer m_timer;
+		QElapsedTimer m_clock;
+		qint64 m_lastTime; //of the last call to advance()
+		int m_tickInterval;
+		bool m_paused;
+		bool m_delivering; //frame changes by the timer itself are not resynced
+};
+
+} //namespace Tagaro
+
+#endif // TAGARO_ANIMATIONCLOCK_P_H
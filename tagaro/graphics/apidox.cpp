@@ -254,4 +254,37 @@ SourceType=ccsvg:path/to/file.svg
 ColorKey=#ffffff
 @endcode
 
+@section render-tracing Tracing the rendering pipeline
+
+To diagnose stalls in the rendering pipeline, set the environment variable
+TAGARO_TRACE_FILE to a file path before starting the application. Tagaro will
+then record all rendering jobs, cache lookups and pixmap deliveries (including
+the thread, element, render size and cache outcome of each), and write them to
+this file when the application exits. The file can be loaded into the
+about:tracing page of Chrome or Chromium.
+
+@code
+TAGARO_TRACE_FILE=/tmp/trace.json kdiamond
+@endcode
+
+@section render-recording Recording and replaying sessions
+
+To reproduce performance problems, set the environment variable
+TAGARO_RECORD_FILE to a file path before starting the application. Tagaro will
+then log all requests which sprite clients make to the rendering pipeline
+(creation, size changes, frame changes etc.), as well as theme switches. The
+log can be replayed with the tagaro-replay tool, which needs the theme files
+that were used during the recording:
+
+@code
+TAGARO_RECORD_FILE=/tmp/session.log kdiamond
+tagaro-replay /tmp/session.log /usr/share/apps/kdiamond/themes/default.desktop
+@endcode
+
+The requests are replayed back-to-back in the order of the log. Unless the
+--threaded option is given, the rendering jobs are executed in the
+deterministic mode of Tagaro::RenderScheduler, so that measurements are
+reproducible. In this mode, a fixed number of jobs (see the --jobs-per-event
+option) is executed after each request.
+
 */
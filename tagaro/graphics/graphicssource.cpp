@@ -18,11 +18,20 @@
 
 #include "graphicssource.h"
 #include "graphicssourceconfig.h"
+#include "rendertrace_p.h"
 #include "settings.h"
 
+#include <QtCore/QBasicTimer>
+#include <QtCore/QBitArray>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QCryptographicHash>
+#include <QtCore/QDataStream>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
 #include <QtCore/QStringBuilder>
+#include <QtCore/QTimerEvent>
+#include <KDE/KConfig>
+#include <KDE/KConfigGroup>
 #include <KDE/KGlobal>
 #include <KDE/KImageCache>
 #include <KDE/KStandardDirs>
@@ -92,6 +101,28 @@ QRectF Tagaro::GraphicsSource::elementBounds(const QString& element) const
 	return QRectF();
 }
 
+QStringList Tagaro::GraphicsSource::elementKeys() const
+{
+	//see documentation
+	return QStringList();
+}
+
+bool Tagaro::GraphicsSource::supportsBatchRendering() const
+{
+	//see documentation
+	return false;
+}
+
+QList<QImage> Tagaro::GraphicsSource::elementImages(const QStringList& elements, const QSize& size, const QString& processingInstruction) const
+{
+	QList<QImage> result;
+	foreach (const QString& element, elements)
+	{
+		result << elementImage(element, size, processingInstruction, false);
+	}
+	return result;
+}
+
 int Tagaro::GraphicsSource::frameCount(const QString& element) const
 {
 	//look for animated sprite first
@@ -139,34 +170,199 @@ QString Tagaro::GraphicsSource::frameElementKey(const QString& element, int fram
 }
 
 //END Tagaro::GraphicsSource
+//BEGIN ElementIndex
+
+namespace Tagaro {
+
+//A bloom filter over all element keys of a graphics source. It cannot tell
+//for sure that an element exists, but it can tell for sure that an element
+//does not exist. It is small enough to be kept in the disk cache, so these
+//negative answers are available without loading the graphics source.
+class ElementIndex
+{
+	public:
+		ElementIndex() : m_hashCount(0) {}
+		explicit ElementIndex(const QStringList& keys);
+
+		inline bool isValid() const { return m_hashCount > 0; }
+		bool mightContain(const QString& key) const;
+
+		friend QDataStream& operator<<(QDataStream& stream, const ElementIndex& index);
+		friend QDataStream& operator>>(QDataStream& stream, ElementIndex& index);
+	private:
+		//NOTE: Do not use qHash() here. The bit positions are persisted in the
+		//disk cache, so the hash functions must never change.
+		static void hash(const QString& key, uint& h1, uint& h2);
+
+		QBitArray m_bits;
+		int m_hashCount;
+};
+
+ElementIndex::ElementIndex(const QStringList& keys)
+	: m_hashCount(0)
+{
+	if (keys.isEmpty())
+	{
+		return; //source cannot enumerate its elements
+	}
+	//10 bits per key and 7 hash functions give a false positive rate of 1%
+	m_bits.resize(qMax(64, keys.count() * 10));
+	m_hashCount = 7;
+	const int bitCount = m_bits.size();
+	foreach (const QString& key, keys)
+	{
+		uint h1, h2;
+		hash(key, h1, h2);
+		for (int i = 0; i < m_hashCount; ++i)
+		{
+			m_bits.setBit((h1 + i * h2) % bitCount);
+		}
+	}
+}
+
+void ElementIndex::hash(const QString& key, uint& h1, uint& h2)
+{
+	//FNV-1a and DJB2 over the UTF-16 code units
+	h1 = 2166136261u;
+	h2 = 5381;
+	const ushort* data = key.utf16();
+	for (int i = 0; i < key.size(); ++i)
+	{
+		h1 = (h1 ^ data[i]) * 16777619u;
+		h2 = (h2 << 5) + h2 + data[i];
+	}
+	h2 |= 1; //avoid degenerate probe sequences
+}
+
+bool ElementIndex::mightContain(const QString& key) const
+{
+	if (!isValid())
+	{
+		return true;
+	}
+	uint h1, h2;
+	hash(key, h1, h2);
+	const int bitCount = m_bits.size();
+	for (int i = 0; i < m_hashCount; ++i)
+	{
+		if (!m_bits.testBit((h1 + i * h2) % bitCount))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+QDataStream& operator<<(QDataStream& stream, const ElementIndex& index)
+{
+	return stream << qint32(index.m_hashCount) << index.m_bits;
+}
+
+QDataStream& operator>>(QDataStream& stream, ElementIndex& index)
+{
+	qint32 hashCount;
+	stream >> hashCount >> index.m_bits;
+	index.m_hashCount = (stream.status() == QDataStream::Ok && !index.m_bits.isEmpty()) ? hashCount : 0;
+	return stream;
+}
+
+} //namespace Tagaro
+
+//END ElementIndex
 //BEGIN Tagaro::CachedProxyGraphicsSource
 
-struct Tagaro::CachedProxyGraphicsSource::Private
+//all live proxy sources, for flushCaches()
+K_GLOBAL_STATIC(QSet<QObject*>, g_cachedProxySources)
+
+//time until changes to the metadata and statistics are written (so that the
+//many lookups during a cold start result in one write)
+static const int g_flushDelay = 1000; //milliseconds
+
+struct Tagaro::CachedProxyGraphicsSource::Private : public QObject
 {
 	Tagaro::GraphicsSource* m_source;
 	//disk cache
 	KImageCache* m_cache;
-	//in-process cache
+	//in-process cache (also serialized into the disk cache as one blob, see
+	//readMetadata() and writeMetadata(); the blob is rewritten shortly after
+	//these caches change, so that it survives crashes)
 	QHash<QString, QRectF> m_boundsCache;
+	QHash<QString, bool> m_existsCache;
 	QHash<QString, int> m_frameCountCache;
+	Tagaro::ElementIndex m_index;
+	bool m_metadataDirty;
+	QBasicTimer m_flushTimer;
+	//statistics (protected by m_statsMutex because elementImage() is called
+	//from rendering threads)
+	QMutex m_statsMutex;
+	QSet<QString> m_workingSet;
+	qint64 m_workingSetSize;
+	//the working set size of the previous sessions (-1 if not read yet)
+	qint64 m_previousWorkingSetSize;
+	bool m_statsDirty;
+	int m_hits, m_misses, m_cacheSize;
+	QString m_statsPath;
 	//state description
 	bool m_valid, m_loaded, m_sourceLoaded, m_useCache;
 	//m_useCache refers to the disk cache only, not to the in-process cache
 
 	Private(Tagaro::GraphicsSource* source);
-
+	~Private();
+
+	bool loadSource();
+	//returns false if there is no usable blob
+	bool readMetadata();
+	void writeMetadata();
+	//schedules writeMetadata() (GUI thread only)
+	void setMetadataDirty();
+	void scheduleFlush();
+	//Writes pending metadata and statistics of all sources. This is a post
+	//routine of the application because the sources might be deleted only
+	//during static destruction, when the disk cache and KGlobal are gone.
+	static void flushCaches();
+	void flushCache();
+	int chooseCacheSize();
+	void writeStatistics(qint64 workingSetSize);
+	void recordImage(const QString& key, const QImage& image, bool hit);
 	QRectF elementBounds(const QString& element);
+	bool elementExists(const QString& element);
 	QImage elementImage(const QString& element, const QSize& size, const QString& processingInstruction, bool timeConstraint);
+protected:
+	//posted by recordImage() from the rendering threads
+	virtual void customEvent(QEvent* event);
+	virtual void timerEvent(QTimerEvent* event);
 };
 
 Tagaro::CachedProxyGraphicsSource::Private::Private(Tagaro::GraphicsSource* source)
 	: m_source(source)
 	, m_cache(0)
+	, m_metadataDirty(false)
+	, m_workingSetSize(0)
+	, m_previousWorkingSetSize(-1)
+	, m_statsDirty(false)
+	, m_hits(0)
+	, m_misses(0)
+	, m_cacheSize(0)
 	, m_valid(false)
 	, m_loaded(false)
 	, m_sourceLoaded(false)
 	, m_useCache(Tagaro::Settings::useDiskCache() && source->config().cacheSize() > 0)
 {
+	static bool postRoutineAdded = false;
+	if (!postRoutineAdded)
+	{
+		qAddPostRoutine(flushCaches);
+		postRoutineAdded = true;
+	}
+	g_cachedProxySources->insert(this);
+}
+
+Tagaro::CachedProxyGraphicsSource::Private::~Private()
+{
+	if (!g_cachedProxySources.isDestroyed())
+	{
+		g_cachedProxySources->remove(this);
+	}
 }
 
 Tagaro::CachedProxyGraphicsSource::CachedProxyGraphicsSource(Tagaro::GraphicsSource* source)
@@ -177,6 +373,10 @@ Tagaro::CachedProxyGraphicsSource::CachedProxyGraphicsSource(Tagaro::GraphicsSou
 
 Tagaro::CachedProxyGraphicsSource::~CachedProxyGraphicsSource()
 {
+	//The metadata blob and the statistics are not written here: this may run
+	//during static destruction (see Tagaro::RenderJobTable), when the cache
+	//and KGlobal are gone already. Pending changes are written by
+	//flushCaches() instead.
 	delete d->m_source;
 	delete d->m_cache;
 	delete d;
@@ -218,7 +418,9 @@ bool Tagaro::CachedProxyGraphicsSource::load()
 	}
 	//open cache, check timestamp vs. last write access to graphics file
 	//(shift by 20 converts megabytes to bytes)
-	d->m_cache = new KImageCache(cacheName, config().cacheSize() << 20);
+	d->m_statsPath = KStandardDirs::locateLocal("cache", cacheName + QLatin1String(".stats"));
+	d->m_cacheSize = d->chooseCacheSize();
+	d->m_cache = new KImageCache(cacheName, d->m_cacheSize << 20);
 	d->m_cache->setPixmapCaching(false); //see comment below this method
 	if (d->m_cache->timestamp() < d->m_source->lastModified())
 	{
@@ -227,6 +429,12 @@ bool Tagaro::CachedProxyGraphicsSource::load()
 		d->m_sourceLoaded = true;
 		d->m_valid = d->m_source->isValid();
 	}
+	//all metadata queries are served from memory from now on
+	//(replace missing or outdated blobs soon)
+	if (d->m_valid && !d->readMetadata())
+	{
+		d->setMetadataDirty();
+	}
 	return d->m_valid;
 }
 
@@ -250,14 +458,220 @@ bool Tagaro::CachedProxyGraphicsSource::load()
 //As you see, implementing an own pixmap cache saves us one conversion. We
 //therefore disable KIC's pixmap cache because we do not need it.
 
-QRectF Tagaro::CachedProxyGraphicsSource::Private::elementBounds(const QString& element)
+//The metadata blob contains the in-process caches for bounds, existence and
+//frame counts, and the element index. It is stored as one cache entry (instead
+//of one entry per element and metadata type) to keep the many small entries
+//from crowding image data out of the cache, and to read all metadata with one
+//lookup in the memory-mapped cache file. The layout is:
+//    quint32 magic, quint32 version, [version-specific payload]
+//Increase the version whenever the payload format changes; blobs with unknown
+//versions are ignored (and overwritten when the cache is loaded).
+static const QString metadataKey = QString::fromLatin1("metadata");
+static const quint32 metadataMagic = 0x5447444d; //"TGDM"
+static const quint32 metadataVersion = 1;
+
+bool Tagaro::CachedProxyGraphicsSource::Private::readMetadata()
+{
+	QByteArray buffer;
+	if (!m_cache || !m_cache->find(metadataKey, &buffer))
+	{
+		return false;
+	}
+	QDataStream stream(buffer);
+	stream.setVersion(QDataStream::Qt_4_6);
+	quint32 magic, version;
+	stream >> magic >> version;
+	if (magic != metadataMagic || version != metadataVersion)
+	{
+		kDebug() << "Ignoring metadata blob with unknown format";
+		return false;
+	}
+	stream >> m_boundsCache >> m_existsCache >> m_frameCountCache >> m_index;
+	if (stream.status() != QDataStream::Ok)
+	{
+		kDebug() << "Ignoring corrupted metadata blob";
+		m_boundsCache.clear();
+		m_existsCache.clear();
+		m_frameCountCache.clear();
+		m_index = Tagaro::ElementIndex();
+		return false;
+	}
+	return true;
+}
+
+void Tagaro::CachedProxyGraphicsSource::Private::writeMetadata()
+{
+	if (!m_cache)
+	{
+		return;
+	}
+	QByteArray buffer;
+	{
+		QDataStream stream(&buffer, QIODevice::WriteOnly);
+		stream.setVersion(QDataStream::Qt_4_6);
+		stream << metadataMagic << metadataVersion;
+		stream << m_boundsCache << m_existsCache << m_frameCountCache << m_index;
+	}
+	m_cache->insert(metadataKey, buffer);
+}
+
+void Tagaro::CachedProxyGraphicsSource::Private::setMetadataDirty()
+{
+	m_metadataDirty = true;
+	scheduleFlush();
+}
+
+void Tagaro::CachedProxyGraphicsSource::Private::scheduleFlush()
+{
+	if (!m_flushTimer.isActive())
+	{
+		m_flushTimer.start(g_flushDelay, this);
+	}
+}
+
+void Tagaro::CachedProxyGraphicsSource::Private::customEvent(QEvent* event)
+{
+	Q_UNUSED(event)
+	scheduleFlush();
+}
+
+void Tagaro::CachedProxyGraphicsSource::Private::timerEvent(QTimerEvent* event)
+{
+	if (event->timerId() != m_flushTimer.timerId())
+	{
+		QObject::timerEvent(event);
+		return;
+	}
+	m_flushTimer.stop(); //singleshot behavior
+	flushCache();
+}
+
+void Tagaro::CachedProxyGraphicsSource::Private::flushCache()
+{
+	if (m_metadataDirty)
+	{
+		m_metadataDirty = false;
+		writeMetadata();
+	}
+	qint64 workingSetSize = -1;
+	{
+		QMutexLocker locker(&m_statsMutex);
+		if (m_statsDirty)
+		{
+			m_statsDirty = false;
+			workingSetSize = m_workingSetSize;
+		}
+	}
+	if (workingSetSize >= 0)
+	{
+		writeStatistics(workingSetSize);
+	}
+}
+
+void Tagaro::CachedProxyGraphicsSource::Private::flushCaches()
+{
+	if (g_cachedProxySources.isDestroyed())
+	{
+		return;
+	}
+	foreach (QObject* object, *g_cachedProxySources)
+	{
+		static_cast<Tagaro::CachedProxyGraphicsSource::Private*>(object)->flushCache();
+	}
+}
+
+//The cache size is chosen from the working set of the previous sessions,
+//which is recorded in a small statistics file next to the cache file. (It
+//cannot be stored in the cache itself because the cache size must be known
+//before the cache can be opened.)
+int Tagaro::CachedProxyGraphicsSource::Private::chooseCacheSize()
+{
+	const int minSize = m_source->config().cacheSize();
+	const int maxSize = m_source->config().maxCacheSize();
+	if (maxSize <= minSize)
+	{
+		return minSize;
+	}
+	const KConfig statsFile(m_statsPath, KConfig::SimpleConfig);
+	const KConfigGroup statsGroup(&statsFile, "Statistics");
+	const qlonglong workingSetSize = statsGroup.readEntry("WorkingSetSize", qlonglong(0));
+	//leave 50% headroom for the metadata blob, fragmentation and growth
+	//(shift by 20 converts bytes to megabytes)
+	const int size = int((workingSetSize * 3 / 2) >> 20) + 1;
+	return qBound(minSize, size, maxSize);
+}
+
+void Tagaro::CachedProxyGraphicsSource::Private::writeStatistics(qint64 workingSetSize)
+{
+	if (!m_cache || workingSetSize == 0)
+	{
+		return;
+	}
+	KConfig statsFile(m_statsPath, KConfig::SimpleConfig);
+	KConfigGroup statsGroup(&statsFile, "Statistics");
+	//The statistics are written several times per session, so the result
+	//is always derived from the size of the previous sessions.
+	if (m_previousWorkingSetSize < 0)
+	{
+		m_previousWorkingSetSize = statsGroup.readEntry("WorkingSetSize", qlonglong(0));
+	}
+	//grow immediately, but shrink slowly, to avoid oscillations between
+	//sessions with different workloads
+	const qlonglong oldSize = m_previousWorkingSetSize;
+	const qlonglong newSize = qMax(qlonglong(workingSetSize), (oldSize + workingSetSize) / 2);
+	statsGroup.writeEntry("WorkingSetSize", newSize);
+	statsFile.sync();
+}
+
+void Tagaro::CachedProxyGraphicsSource::Private::recordImage(const QString& key, const QImage& image, bool hit)
+{
+	QMutexLocker locker(&m_statsMutex);
+	if (hit)
+	{
+		++m_hits;
+	}
+	else
+	{
+		++m_misses;
+	}
+	if (!m_workingSet.contains(key))
+	{
+		m_workingSet.insert(key);
+		m_workingSetSize += image.byteCount();
+		//write the statistics soon, in case the process does not exit cleanly
+		//(timers can only be started in the GUI thread)
+		if (!m_statsDirty)
+		{
+			m_statsDirty = true;
+			QCoreApplication::postEvent(this, new QEvent(QEvent::User));
+		}
+	}
+}
+
+Tagaro::CachedProxyGraphicsSource::Statistics Tagaro::CachedProxyGraphicsSource::statistics() const
+{
+	QMutexLocker locker(&d->m_statsMutex);
+	Tagaro::CachedProxyGraphicsSource::Statistics stats;
+	stats.cacheSize = d->m_cache ? d->m_cacheSize : 0;
+	stats.workingSetSize = d->m_workingSetSize;
+	stats.hits = d->m_hits;
+	stats.misses = d->m_misses;
+	return stats;
+}
+
+bool Tagaro::CachedProxyGraphicsSource::Private::loadSource()
 {
 	if (!m_sourceLoaded)
 	{
 		m_sourceLoaded = true;
 		m_valid = m_source->isValid();
 	}
-	return m_valid ? m_source->elementBounds(element) : QRectF();
+	return m_valid;
+}
+
+QRectF Tagaro::CachedProxyGraphicsSource::Private::elementBounds(const QString& element)
+{
+	return loadSource() ? m_source->elementBounds(element) : QRectF();
 }
 
 QRectF Tagaro::CachedProxyGraphicsSource::elementBounds(const QString& element) const
@@ -273,34 +687,38 @@ QRectF Tagaro::CachedProxyGraphicsSource::elementBounds(const QString& element)
 	{
 		return it.value();
 	}
-	//if there's no slow cache...
-	if (!d->m_cache)
+	//ask source and cache for following requests
+	const QRectF bounds = d->elementBounds(element);
+	d->m_boundsCache.insert(element, bounds);
+	d->setMetadataDirty();
+	return bounds;
+}
+
+bool Tagaro::CachedProxyGraphicsSource::Private::elementExists(const QString& element)
+{
+	//if the element index does not know the element, it does not exist
+	if (m_index.isValid() && !m_index.mightContain(element))
 	{
-		const QRectF bounds = d->elementBounds(element);
-		d->m_boundsCache.insert(element, bounds);
-		return bounds;
+		return false;
 	}
-	//...else check slow cache
-	const QString key = QLatin1String("br-") + element;
-	QByteArray buffer;
-	if (d->m_cache->find(key, &buffer))
+	//load source if not loaded yet
+	if (!loadSource())
 	{
-		QDataStream stream(buffer);
-		QRectF bounds;
-		stream >> bounds;
-		d->m_boundsCache.insert(element, bounds);
-		return bounds;
+		return false;
 	}
-	//ask source and cache for following requests
-	const QRectF bounds = d->elementBounds(element);
-	buffer.clear();
+	//now that the source is loaded, build the element index if there is none
+	//(the frame count probing in Tagaro::GraphicsSource::frameCount() will
+	//profit from it immediately)
+	if (!m_index.isValid())
 	{
-		QDataStream stream(&buffer, QIODevice::WriteOnly);
-		stream << bounds;
+		m_index = Tagaro::ElementIndex(m_source->elementKeys());
+		setMetadataDirty();
+		if (m_index.isValid() && !m_index.mightContain(element))
+		{
+			return false;
+		}
 	}
-	d->m_cache->insert(key, buffer);
-	d->m_boundsCache.insert(element, bounds);
-	return bounds;
+	return m_source->elementExists(element);
 }
 
 bool Tagaro::CachedProxyGraphicsSource::elementExists(const QString& element) const
@@ -310,24 +728,32 @@ bool Tagaro::CachedProxyGraphicsSource::elementExists(const QString& element) co
 	{
 		return false;
 	}
-	//load source if not loaded yet
-	if (!d->m_sourceLoaded)
+	//check fast cache
+	QHash<QString, bool>::const_iterator it = d->m_existsCache.constFind(element);
+	if (it != d->m_existsCache.constEnd())
 	{
-		d->m_sourceLoaded = true;
-		d->m_valid = d->m_source->isValid();
+		return it.value();
 	}
-	//ask source
-	return d->m_valid ? d->m_source->elementExists(element) : false;
+	//check element index and source
+	const bool exists = d->elementExists(element);
+	if (exists || !d->m_index.isValid())
+	{
+		//Negative results are not cached if the element index can answer
+		//them. This keeps the metadata blob small.
+		d->m_existsCache.insert(element, exists);
+		d->setMetadataDirty();
+	}
+	return exists;
+}
+
+QStringList Tagaro::CachedProxyGraphicsSource::elementKeys() const
+{
+	return d->loadSource() ? d->m_source->elementKeys() : QStringList();
 }
 
 QImage Tagaro::CachedProxyGraphicsSource::Private::elementImage(const QString& element, const QSize& size, const QString& processingInstruction, bool timeConstraint)
 {
-	if (!m_sourceLoaded)
-	{
-		m_sourceLoaded = true;
-		m_valid = m_source->isValid();
-	}
-	return m_valid ? m_source->elementImage(element, size, processingInstruction, timeConstraint) : QImage();
+	return loadSource() ? m_source->elementImage(element, size, processingInstruction, timeConstraint) : QImage();
 }
 
 QImage Tagaro::CachedProxyGraphicsSource::elementImage(const QString& element, const QSize& size, const QString& processingInstruction, bool timeConstraint) const
@@ -349,8 +775,15 @@ QImage Tagaro::CachedProxyGraphicsSource::elementImage(const QString& element, c
 		key += QChar('@') + processingInstruction;
 	//check cache
 	QImage result;
-	if (d->m_cache->findImage(key, &result))
+	bool found;
 	{
+		Tagaro::RenderTraceScope trace("cache lookup", element, size);
+		found = d->m_cache->findImage(key, &result);
+		trace.setOutcome(found ? Tagaro::RenderTrace::CacheHit : Tagaro::RenderTrace::CacheMiss);
+	}
+	if (found)
+	{
+		d->recordImage(key, result, true);
 		return result;
 	}
 	//render image and cache for the following requests
@@ -358,6 +791,70 @@ QImage Tagaro::CachedProxyGraphicsSource::elementImage(const QString& element, c
 	if (d->m_cache && !result.isNull())
 	{
 		d->m_cache->insertImage(key, result);
+		d->recordImage(key, result, false);
+	}
+	return result;
+}
+
+bool Tagaro::CachedProxyGraphicsSource::supportsBatchRendering() const
+{
+	return d->m_source->supportsBatchRendering();
+}
+
+QList<QImage> Tagaro::CachedProxyGraphicsSource::elementImages(const QStringList& elements, const QSize& size, const QString& processingInstruction) const
+{
+	//fast return if load() has not been called yet or if graphical source is invalid
+	if (!d->m_valid)
+	{
+		return QList<QImage>();
+	}
+	//the no-cache case
+	if (!d->m_cache)
+	{
+		return d->loadSource() ? d->m_source->elementImages(elements, size, processingInstruction) : QList<QImage>();
+	}
+	//look up all elements in the cache
+	static const QString prefix = QLatin1String("%1-%2-");
+	const QString keyPrefix = prefix.arg(size.width()).arg(size.height());
+	QList<QImage> result;
+	QStringList keys, missingElements;
+	QList<int> missingIndexes;
+	for (int i = 0; i < elements.count(); ++i)
+	{
+		QString key = keyPrefix + elements[i];
+		if (!processingInstruction.isEmpty())
+			key += QChar('@') + processingInstruction;
+		keys << key;
+		QImage image;
+		Tagaro::RenderTraceScope trace("cache lookup", elements[i], size);
+		if (d->m_cache->findImage(key, &image))
+		{
+			trace.setOutcome(Tagaro::RenderTrace::CacheHit);
+			d->recordImage(key, image, true);
+		}
+		else
+		{
+			trace.setOutcome(Tagaro::RenderTrace::CacheMiss);
+			missingElements << elements[i];
+			missingIndexes << i;
+		}
+		result << image;
+	}
+	if (missingElements.isEmpty() || !d->loadSource())
+	{
+		return result;
+	}
+	//render the missing elements in one batch
+	const QList<QImage> images = d->m_source->elementImages(missingElements, size, processingInstruction);
+	for (int j = 0; j < images.count() && j < missingIndexes.count(); ++j)
+	{
+		const int i = missingIndexes[j];
+		result[i] = images[j];
+		if (!images[j].isNull())
+		{
+			d->m_cache->insertImage(keys[i], images[j]);
+			d->recordImage(keys[i], images[j], false);
+		}
 	}
 	return result;
 }
@@ -375,24 +872,10 @@ int Tagaro::CachedProxyGraphicsSource::frameCount(const QString& element) const
 	{
 		return it.value();
 	}
-	//if there's no slow cache...
-	if (!d->m_cache)
-	{
-		const int count = Tagaro::GraphicsSource::frameCount(element);
-		d->m_frameCountCache.insert(element, count);
-		return count;
-	}
-	//...else check slow cache
-	const QString key = QLatin1String("fc-") + element;
-	QByteArray buffer;
-	if (d->m_cache->find(key, &buffer))
-	{
-		return buffer.toInt();
-	}
 	//ask source and cache for following requests
 	const int count = Tagaro::GraphicsSource::frameCount(element);
-	d->m_cache->insert(key, QByteArray::number(count));
-	d->m_frameCountCache.insert(key, count);
+	d->m_frameCountCache.insert(element, count);
+	d->setMetadataDirty();
 	return count;
 }
 
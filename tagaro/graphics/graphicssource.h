@@ -19,6 +19,7 @@
 #ifndef TAGARO_GRAPHICSSOURCE_H
 #define TAGARO_GRAPHICSSOURCE_H
 
+#include <QtCore/QStringList>
 #include <QtGui/QImage>
 
 #include <libtagaro_export.h>
@@ -87,6 +88,16 @@ class TAGARO_EXPORT GraphicsSource
 		///
 		///This method shall return true only for renderable elements.
 		virtual bool elementExists(const QString& element) const = 0;
+		///@return the keys of all elements in the loaded file
+		///
+		///This is used by CachedProxyGraphicsSource to answer elementExists()
+		///calls for missing elements without touching the source. The list
+		///may contain keys of non-renderable elements, but it must contain
+		///the keys of all renderable elements.
+		///
+		///The default implementation returns an empty list, which means that
+		///the source cannot enumerate its elements.
+		virtual QStringList elementKeys() const;
 		///@return the given @a element, rendered in the given @a size
 		///
 		///The names of frame elements (@a frame >= 0) shall be formed with
@@ -112,6 +123,23 @@ class TAGARO_EXPORT GraphicsSource
 		///@warning This method must be thread-safe when @a timeConstraint is
 		///false.
 		virtual QImage elementImage(const QString& element, const QSize& size, const QString& processingInstruction, bool timeConstraint) const = 0;
+		///@return whether elementImages() is faster than multiple calls to
+		///elementImage()
+		///
+		///Rendering threads use elementImages() for multiple elements (e.g.
+		///the frames of an animation strip) only if this returns true. The
+		///default implementation returns false.
+		virtual bool supportsBatchRendering() const;
+		///@return the given @a elements, rendered in the given @a size
+		///
+		///This is equivalent to calling elementImage() for each element
+		///(without time constraint), which is what the default
+		///implementation does. Reimplement this method together with
+		///supportsBatchRendering() if the source can share work between the
+		///elements.
+		///
+		///@warning This method must be thread-safe.
+		virtual QList<QImage> elementImages(const QStringList& elements, const QSize& size, const QString& processingInstruction) const;
 		///@return the frame count of the given @a element
 		///
 		///The semantics are similar to Tagaro::Sprite::frameCount:
@@ -134,8 +162,8 @@ class TAGARO_EXPORT GraphicsSource
 	protected:
 		///Load graphical elements from external resources (if there are any).
 		///It is guaranteed that this method will be called before any call to
-		///elementBounds(), elementExists(), elementImage(), frameCount() and
-		///frameElementKey() with @a useFrameCount == true.
+		///elementBounds(), elementExists(), elementKeys(), elementImage(),
+		///frameCount() and frameElementKey() with @a useFrameCount == true.
 		///
 		///The default implementation assumes that there are no external
 		///resources, and does nothing (returning true).
@@ -150,10 +178,37 @@ class TAGARO_EXPORT GraphicsSource
  *
  * Provides disk caching for sources with complex graphics sources.
  * In-process caches are provided for element metadata, but not for images.
+ * The metadata caches are stored in the disk cache as one blob, which is read
+ * completely when the source is loaded, and written back on destruction.
+ *
+ * Negative elementExists() results are answered by a bloom filter over all
+ * elementKeys() of the source if the source can enumerate its elements. The
+ * bloom filter is stored in the disk cache, so that lookups for missing
+ * elements do not need to load the source even after a restart.
  */
 class TAGARO_EXPORT CachedProxyGraphicsSource : public Tagaro::GraphicsSource
 {
 	public:
+		///Statistics about the disk cache of a CachedProxyGraphicsSource.
+		struct Statistics
+		{
+			///the size of the disk cache in megabytes (0 if no disk cache is
+			///used), as chosen from the working set of the previous sessions
+			int cacheSize;
+			///the total size in bytes of the distinct images (i.e. distinct
+			///combinations of element, size and processing instruction) which
+			///have been served in this session
+			qint64 workingSetSize;
+			///the number of images which were served from the disk cache
+			int hits;
+			///the number of images which had to be rendered
+			int misses;
+
+			///@return the fraction of images which were served from the disk
+			///cache, or 0 if no images have been served yet
+			inline qreal hitRate() const { return (hits + misses) ? qreal(hits) / (hits + misses) : 0.0; } //krazy:exclude=inline
+		};
+
 		///Creates a new Tagaro::CachedProxyGraphicsSource. The given @a source
 		///will be used to actually do the rendering work. The proxy takes
 		///ownership of the given @a source.
@@ -164,8 +219,19 @@ class TAGARO_EXPORT CachedProxyGraphicsSource : public Tagaro::GraphicsSource
 
 		virtual QRectF elementBounds(const QString& element) const;
 		virtual bool elementExists(const QString& element) const;
+		virtual QStringList elementKeys() const;
 		virtual QImage elementImage(const QString& element, const QSize& size, const QString& processingInstruction, bool timeConstraint) const;
+		virtual bool supportsBatchRendering() const;
+		virtual QList<QImage> elementImages(const QStringList& elements, const QSize& size, const QString& processingInstruction) const;
 		virtual int frameCount(const QString& element) const;
+
+		///@return statistics about the disk cache
+		///
+		///The cache size is adapted automatically: The working set size of
+		///each session is recorded, and the next session chooses its cache
+		///size from it, within the bounds given by the config()'s cacheSize()
+		///and maxCacheSize().
+		Tagaro::CachedProxyGraphicsSource::Statistics statistics() const;
 	protected:
 		virtual bool load();
 	private:
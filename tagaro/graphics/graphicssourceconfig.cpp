@@ -22,7 +22,7 @@
 
 struct Tagaro::GraphicsSourceConfig::Private
 {
-	int m_cacheSize, m_frameBaseIndex;
+	int m_cacheSize, m_maxCacheSize, m_prefetchFrameCount, m_alphaThreshold, m_frameBaseIndex;
 	QString m_frameSuffix;
 
 	Private();
@@ -30,6 +30,9 @@ struct Tagaro::GraphicsSourceConfig::Private
 
 Tagaro::GraphicsSourceConfig::Private::Private()
 	: m_cacheSize(3) //in megabytes
+	, m_maxCacheSize(32) //in megabytes
+	, m_prefetchFrameCount(3)
+	, m_alphaThreshold(1)
 	, m_frameBaseIndex(0)
 	, m_frameSuffix(QLatin1String("_%1"))
 {
@@ -66,6 +69,36 @@ void Tagaro::GraphicsSourceConfig::setCacheSize(int cacheSize)
 	d->m_cacheSize = cacheSize;
 }
 
+int Tagaro::GraphicsSourceConfig::maxCacheSize() const
+{
+	return d->m_maxCacheSize;
+}
+
+void Tagaro::GraphicsSourceConfig::setMaxCacheSize(int maxCacheSize)
+{
+	d->m_maxCacheSize = maxCacheSize;
+}
+
+int Tagaro::GraphicsSourceConfig::prefetchFrameCount() const
+{
+	return d->m_prefetchFrameCount;
+}
+
+void Tagaro::GraphicsSourceConfig::setPrefetchFrameCount(int prefetchFrameCount)
+{
+	d->m_prefetchFrameCount = prefetchFrameCount;
+}
+
+int Tagaro::GraphicsSourceConfig::alphaThreshold() const
+{
+	return d->m_alphaThreshold;
+}
+
+void Tagaro::GraphicsSourceConfig::setAlphaThreshold(int alphaThreshold)
+{
+	d->m_alphaThreshold = qBound(0, alphaThreshold, 255);
+}
+
 int Tagaro::GraphicsSourceConfig::frameBaseIndex() const
 {
 	return d->m_frameBaseIndex;
@@ -36,6 +36,9 @@ class TAGARO_EXPORT GraphicsSourceConfig
 	public:
 		///Creates a new Tagaro::GraphicsSourceConfig instance with default values:
 		///@li cacheSize() == 3 (megabytes)
+		///@li maxCacheSize() == 32 (megabytes)
+		///@li prefetchFrameCount() == 3
+		///@li alphaThreshold() == 1
 		///@li frameBaseIndex() == 0
 		///@li frameSuffix() = "_%1"
 		GraphicsSourceConfig();
@@ -54,6 +57,48 @@ class TAGARO_EXPORT GraphicsSourceConfig
 		///
 		///@see Tagaro::CachedProxyGraphicsSource
 		void setCacheSize(int cacheSize);
+		///@return the maximum cache size in megabytes @see setMaxCacheSize
+		int maxCacheSize() const;
+		///Sets the maximum cache size in megabytes (default: 32 megabytes).
+		///
+		///Caching sources measure the working set of the images which they
+		///serve in each session, and choose their cache size for the next
+		///session from this measurement. The cacheSize() is then used as the
+		///minimum cache size, and this value as the maximum. If the maximum
+		///is not bigger than the cacheSize(), the cacheSize() is always used.
+		///
+		///@see Tagaro::CachedProxyGraphicsSource::statistics
+		void setMaxCacheSize(int maxCacheSize);
+		///@return the number of prefetched frames @see setPrefetchFrameCount
+		int prefetchFrameCount() const;
+		///Sets the number of frames which are prefetched for animated sprites
+		///(default: 3). When a client steps through the frames of an animated
+		///sprite one by one, the next frames in this direction are rendered
+		///in advance with Tagaro::RenderScheduler::PrefetchPriority, so that
+		///the animation does not stutter when it is played for the first
+		///time. Set to 0 to disable prefetching.
+		///
+		///If the source supports batch rendering, all prefetched frames are
+		///rendered in one job.
+		///
+		///@see Tagaro::GraphicsSource::elementImages
+		void setPrefetchFrameCount(int prefetchFrameCount);
+		///@return the alpha threshold for hit tests @see setAlphaThreshold
+		int alphaThreshold() const;
+		///Sets the minimum alpha value (between 0 and 255) which a pixel
+		///must have to be considered opaque by hit tests and collision
+		///detection (default: 1, i.e. only fully transparent pixels are
+		///ignored). Set to 0 to make the whole bounding rectangle of a sprite
+		///opaque.
+		///
+		///A 1-bit mask with this threshold, and the outline of its opaque
+		///pixels, are built for every frame when it is rendered, so that hit
+		///tests do not need to read back pixels from the pixmap. Changes
+		///only affect frames which are rendered afterwards.
+		///
+		///@see Tagaro::SpriteClient::isOpaqueAt
+		///@see Tagaro::SpriteClient::opaqueShape
+		void setAlphaThreshold(int alphaThreshold);
 		///@return the frame base index @see setFrameBaseIndex()
 		int frameBaseIndex() const;
 		///Sets the frame base index, i.e. the lowest frame index. Usually,
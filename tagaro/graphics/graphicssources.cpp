@@ -18,6 +18,7 @@
  ***************************************************************************/
 
 #include "graphicssources.h"
+#include "rendertrace_p.h"
 
 #include <QtCore/QDateTime>
 #include <QtCore/QFile>
@@ -26,6 +27,7 @@
 #include <QtCore/QMap>
 #include <QtCore/QMutex>
 #include <QtCore/QThread>
+#include <QtCore/QXmlStreamReader>
 #include <QtGui/QPainter>
 #include <QtSvg/QSvgRenderer>
 #include <KDE/KDebug> //for kWarning
@@ -56,6 +58,32 @@ static QByteArray readSVG(const QString& path)
 	return file;
 }
 
+static QStringList readSVGIds(const QByteArray& svgData)
+{
+	//collect all ids, not only those of renderable elements (see
+	//Tagaro::GraphicsSource::elementKeys() for why this is okay)
+	QStringList ids;
+	QXmlStreamReader reader(svgData);
+	while (!reader.atEnd())
+	{
+		if (reader.readNext() == QXmlStreamReader::StartElement)
+		{
+			const QStringRef id = reader.attributes().value(QLatin1String("id"));
+			if (!id.isEmpty())
+			{
+				ids << id.toString();
+			}
+		}
+	}
+	if (reader.hasError())
+	{
+		//an incomplete list would make the caller believe that the missing
+		//elements do not exist
+		return QStringList();
+	}
+	return ids;
+}
+
 //BEGIN Tagaro::QtSvgGraphicsSource
 
 struct Tagaro::QtSvgGraphicsSource::Private
@@ -70,6 +98,9 @@ struct Tagaro::QtSvgGraphicsSource::Private
 	//This class uses a pool of renderer instances to implement the required
 	//thread-safety. Access this only with the two helper functions below!
 	QHash<QSvgRenderer*, QThread*> m_hash;
+	//the renderer which each thread has used last (threads get the same
+	//renderer again if possible, because its caches are still warm)
+	QHash<QThread*, QSvgRenderer*> m_lastRenderers;
 	QMutex m_mutex;
 
 	//Returns a SVG renderer instance that can be used in the calling thread.
@@ -88,7 +119,11 @@ QSvgRenderer* Tagaro::QtSvgGraphicsSource::Private::allocRenderer()
 	//look for an available renderer
 	QThread* thread = QThread::currentThread();
 	QMutexLocker locker(&m_mutex);
-	QSvgRenderer* renderer = m_hash.key(0);
+	QSvgRenderer* renderer = m_lastRenderers.value(thread);
+	if (!renderer || m_hash.value(renderer))
+	{
+		renderer = m_hash.key(0);
+	}
 	if (!renderer)
 	{
 		//instantiate a new renderer
@@ -101,6 +136,7 @@ QSvgRenderer* Tagaro::QtSvgGraphicsSource::Private::allocRenderer()
 	}
 	//mark renderer as used
 	m_hash.insert(renderer, thread);
+	m_lastRenderers.insert(thread, renderer);
 	return m_invalid ? 0 : renderer;
 }
 
@@ -176,28 +212,63 @@ bool Tagaro::QtSvgGraphicsSource::elementExists(const QString& element) const
 	return result;
 }
 
+QStringList Tagaro::QtSvgGraphicsSource::elementKeys() const
+{
+	return d->m_invalid ? QStringList() : readSVGIds(d->m_svgData);
+}
+
+static QImage renderElement(QSvgRenderer* renderer, const QString& element, const QSize& size)
+{
+	Tagaro::RenderTraceScope trace("QtSvg render", element, size);
+	QImage image(size, QImage::Format_ARGB32_Premultiplied);
+	image.fill(QColor(Qt::transparent).rgba());
+	QPainter painter(&image);
+	renderer->render(&painter, element);
+	painter.end();
+	return image;
+}
+
 QImage Tagaro::QtSvgGraphicsSource::elementImage(const QString& element, const QSize& size, const QString& processingInstruction, bool timeConstraint) const
 {
 	Q_UNUSED(processingInstruction) //does not define any processing instructions
 	if (timeConstraint)
 	{
+		//rendering SVG elements is always time-consuming ;-)
 		return QImage();
 	}
-	//rendering SVG elements is always time-consuming ;-)
-	QImage image(size, QImage::Format_ARGB32_Premultiplied);
-	image.fill(QColor(Qt::transparent).rgba());
-	QPainter painter(&image);
 	QSvgRenderer* r = d->allocRenderer();
 	if (!r)
 	{
 		return QImage();
 	}
-	r->render(&painter, element);
+	const QImage image = renderElement(r, element, size);
 	d->freeRenderer(r);
-	painter.end();
 	return image;
 }
 
+bool Tagaro::QtSvgGraphicsSource::supportsBatchRendering() const
+{
+	return true;
+}
+
+QList<QImage> Tagaro::QtSvgGraphicsSource::elementImages(const QStringList& elements, const QSize& size, const QString& processingInstruction) const
+{
+	Q_UNUSED(processingInstruction) //does not define any processing instructions
+	//allocate the renderer only once for all elements
+	QSvgRenderer* r = d->allocRenderer();
+	if (!r)
+	{
+		return QList<QImage>();
+	}
+	QList<QImage> result;
+	foreach (const QString& element, elements)
+	{
+		result << renderElement(r, element, size);
+	}
+	d->freeRenderer(r);
+	return result;
+}
+
 //END Tagaro::QtSvgGraphicsSource
 //BEGIN Tagaro::QtColoredSvgGraphicsSource
 
@@ -263,6 +334,11 @@ bool Tagaro::QtColoredSvgGraphicsSource::elementExists(const QString& element) c
 	return d->m_hash.begin().value()->elementExists(element);
 }
 
+QStringList Tagaro::QtColoredSvgGraphicsSource::elementKeys() const
+{
+	return readSVGIds(d->m_svgData);
+}
+
 QImage Tagaro::QtColoredSvgGraphicsSource::elementImage(const QString& element, const QSize& size, const QString& processingInstruction, bool timeConstraint) const
 {
 	if(processingInstruction.isEmpty())
@@ -379,6 +455,11 @@ bool Tagaro::ImageGraphicsSource::elementExists(const QString& element) const
 	return d->m_elements.contains(element);
 }
 
+QStringList Tagaro::ImageGraphicsSource::elementKeys() const
+{
+	return d->m_elements.keys();
+}
+
 QImage Tagaro::ImageGraphicsSource::elementImage(const QString& element, const QSize& size, const QString& processingInstruction, bool timeConstraint) const
 {
 	Q_UNUSED(processingInstruction) //does not define any processing instructions
@@ -39,7 +39,10 @@ class QtSvgGraphicsSource : public Tagaro::GraphicsSource
 		virtual uint lastModified() const;
 		virtual QRectF elementBounds(const QString& element) const;
 		virtual bool elementExists(const QString& element) const;
+		virtual QStringList elementKeys() const;
 		virtual QImage elementImage(const QString& element, const QSize& size, const QString& processingInstruction, bool timeConstraint) const;
+		virtual bool supportsBatchRendering() const;
+		virtual QList<QImage> elementImages(const QStringList& elements, const QSize& size, const QString& processingInstruction) const;
 	protected:
 		virtual bool load();
 	private:
@@ -58,6 +61,7 @@ class QtColoredSvgGraphicsSource : public Tagaro::GraphicsSource
 		virtual uint lastModified() const;
 		virtual QRectF elementBounds(const QString& element) const;
 		virtual bool elementExists(const QString& element) const;
+		virtual QStringList elementKeys() const;
 		/// Passing an empty QString as @a processingInstruction gives unmodified Sprites
 		virtual QImage elementImage(const QString& element, const QSize& size, const QString& processingInstruction, bool timeConstraint) const;
 	private:
@@ -89,6 +93,7 @@ class ImageGraphicsSource : public Tagaro::GraphicsSource
 
 		virtual QRectF elementBounds(const QString& element) const;
 		virtual bool elementExists(const QString& element) const;
+		virtual QStringList elementKeys() const;
 		virtual QImage elementImage(const QString& element, const QSize& size, const QString& processingInstruction, bool timeConstraint) const;
 	private:
 		class Private;
@@ -0,0 +1,89 @@
+/***************************************************************************
+ *   Copyright 2011 Stefan Majewsky <majewsky@gmx.net>                     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "renderrecorder_p.h"
+
+#include <QtCore/QUrl>
+#include <KDE/KGlobal>
+
+K_GLOBAL_STATIC(Tagaro::RenderRecorder, g_recorder)
+
+Tagaro::RenderRecorder::RenderRecorder()
+	: m_file(QFile::decodeName(qgetenv("TAGARO_RECORD_FILE")))
+	, m_nextClientId(0)
+{
+	if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+	{
+		qWarning("Tagaro::RenderRecorder: Cannot write log file %s", qPrintable(m_file.fileName()));
+	}
+	m_file.write("# tagaro render log 1\n");
+	m_file.flush();
+	m_clock.start();
+}
+
+Tagaro::RenderRecorder* Tagaro::RenderRecorder::instance()
+{
+	static const bool enabled = !qgetenv("TAGARO_RECORD_FILE").isEmpty();
+	return (enabled && !g_recorder.isDestroyed()) ? static_cast<Tagaro::RenderRecorder*>(g_recorder) : 0;
+}
+
+QByteArray Tagaro::RenderRecorder::encode(const QString& string)
+{
+	//"-" is encoded because it denotes the empty string
+	return string.isEmpty() ? QByteArray("-") : QUrl::toPercentEncoding(string, QByteArray(), "-");
+}
+
+void Tagaro::RenderRecorder::record(const char* command, const QByteArray& arguments)
+{
+	//QElapsedTimer::nsecsElapsed() needs Qt 4.8
+	QByteArray line = QByteArray::number(m_clock.elapsed() * 1000);
+	line += ' ';
+	line += command;
+	if (!arguments.isEmpty())
+	{
+		line += ' ';
+		line += arguments;
+	}
+	line += '\n';
+	m_file.write(line);
+	//logs are often recorded to reproduce crashes, so nothing may stay in
+	//the buffer
+	m_file.flush();
+}
+
+void Tagaro::RenderRecorder::record(const char* command, const Tagaro::SpriteClient* client, const QByteArray& arguments)
+{
+	QHash<const Tagaro::SpriteClient*, int>::const_iterator it = m_clients.constFind(client);
+	const int id = (it != m_clients.constEnd()) ? it.value() : m_clients.insert(client, m_nextClientId++).value();
+	QByteArray clientArguments = QByteArray::number(id);
+	if (!arguments.isEmpty())
+	{
+		clientArguments += ' ';
+		clientArguments += arguments;
+	}
+	record(command, clientArguments);
+}
+
+void Tagaro::RenderRecorder::removeClient(const Tagaro::SpriteClient* client)
+{
+	if (m_clients.contains(client))
+	{
+		record("destroy", client);
+		m_clients.remove(client);
+	}
+}
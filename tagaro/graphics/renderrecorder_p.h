@@ -0,0 +1,76 @@
+/***************************************************************************
+ *   Copyright 2011 Stefan Majewsky <majewsky@gmx.net>                     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef TAGARO_RENDERRECORDER_P_H
+#define TAGARO_RENDERRECORDER_P_H
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+
+namespace Tagaro {
+
+class SpriteClient;
+
+//Records all requests which are made to the rendering pipeline if the
+//environment variable TAGARO_RECORD_FILE is set. The log is written to the
+//file named by this variable, and can be replayed with the tagaro-replay tool.
+//Lives in the GUI thread.
+//
+//The log is a text file with one request per line:
+//
+//    <time in microseconds (with millisecond resolution)> <command> <arguments...>
+//
+//String arguments (sprite keys, processing instructions, theme identifiers)
+//are percent-encoded, and "-" denotes an empty string. Clients are identified
+//by numbers which are assigned in order of creation. The commands are:
+//
+//    create <client> <sprite key>      (SpriteClient constructor)
+//    destroy <client>
+//    sprite <client> <sprite key>      (SpriteClient::setSprite)
+//    size <client> <width> <height>    (SpriteClient::setRenderSize)
+//    frame <client> <frame>            (SpriteClient::setFrame)
+//    pi <client> <instruction>         (SpriteClient::setProcessingInstruction)
+//    priority <client> <priority>      (SpriteClient::setRenderPriority)
+//    delivery <client> <mode>          (SpriteClient::setDeliveryMode)
+//    pixmap <sprite key> <width> <height> <frame> <instruction>
+//                                      (Sprite::pixmap)
+//    theme <theme identifier>          (ThemeProvider::setSelectedTheme)
+class RenderRecorder
+{
+	public:
+		RenderRecorder();
+		//Returns 0 if recording is disabled.
+		static Tagaro::RenderRecorder* instance();
+
+		void record(const char* command, const QByteArray& arguments);
+		void record(const char* command, const Tagaro::SpriteClient* client, const QByteArray& arguments = QByteArray());
+		//Records the destruction of the given client.
+		void removeClient(const Tagaro::SpriteClient* client);
+
+		static QByteArray encode(const QString& string);
+	private:
+		QFile m_file;
+		QElapsedTimer m_clock;
+		QHash<const Tagaro::SpriteClient*, int> m_clients;
+		int m_nextClientId;
+};
+
+} //namespace Tagaro
+
+#endif // TAGARO_RENDERRECORDER_P_H
@@ -0,0 +1,492 @@
+/***************************************************************************
+ *   Copyright 2011 Stefan Majewsky <majewsky@gmx.net>                     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "renderscheduler.h"
+#include "renderscheduler_p.h"
+#include "graphicssource.h"
+#include "rendertrace_p.h"
+#include "settings.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtGui/QColor>
+#include <KDE/KGlobal>
+
+K_GLOBAL_STATIC(Tagaro::RenderRuntime, g_runtime)
+
+//Each priority class receives this many jobs per scheduling round (if it has
+//enough pending jobs). When all classes with pending jobs have used up their
+//share, a new round starts.
+static const int g_priorityWeights[Tagaro::RenderScheduler::PriorityCount] = { 8, 4, 2, 1 };
+//When looking for a job for its own sources, a worker examines only this many
+//jobs at the front of the queue, so that the order of the queue is mostly kept.
+static const int g_affinityWindow = 16;
+
+//BEGIN Tagaro::RenderScheduler
+
+int Tagaro::RenderScheduler::threadCount()
+{
+	return g_runtime->threadCount();
+}
+
+void Tagaro::RenderScheduler::setThreadCount(int count)
+{
+	g_runtime->setThreadCount(count);
+}
+
+Tagaro::RenderScheduler::Statistics Tagaro::RenderScheduler::statistics()
+{
+	return g_runtime->statistics();
+}
+
+bool Tagaro::RenderScheduler::isDeterministic()
+{
+	return g_runtime->isDeterministic();
+}
+
+void Tagaro::RenderScheduler::setDeterministic(bool deterministic)
+{
+	g_runtime->setDeterministic(deterministic);
+}
+
+int Tagaro::RenderScheduler::processPendingJobs(int maxJobs)
+{
+	return g_runtime->processPendingJobs(maxJobs);
+}
+
+//END Tagaro::RenderScheduler
+//BEGIN Tagaro::RenderRuntime
+
+Tagaro::RenderRuntime::RenderRuntime()
+	: m_deterministic(false)
+	, m_runningJobs(0)
+	, m_finishedJobs(0)
+	, m_cancelledJobs(0)
+	, m_stolenJobs(0)
+{
+	for (int p = 0; p < Tagaro::RenderScheduler::PriorityCount; ++p)
+	{
+		m_credits[p] = g_priorityWeights[p];
+		m_latencyCount[p] = 0;
+		m_latencySum[p] = 0;
+		m_latencyMax[p] = 0;
+	}
+	m_clock.start();
+	setThreadCount(Tagaro::Settings::renderingThreadCount());
+}
+
+Tagaro::RenderRuntime::~RenderRuntime()
+{
+	//Drop pending jobs. They are not deleted because the RenderJobTable
+	//still references them, and the process is going down anyway.
+	m_mutex.lock();
+	for (int p = 0; p < Tagaro::RenderScheduler::PriorityCount; ++p)
+	{
+		m_queues[p].clear();
+	}
+	//stop all threads (setThreadCount() cannot do this because it keeps at
+	//least one thread)
+	const QList<Tagaro::RenderWorker*> workers = removeAllWorkers();
+	m_mutex.unlock();
+	foreach (Tagaro::RenderWorker* worker, workers)
+	{
+		worker->wait();
+	}
+	qDeleteAll(workers);
+}
+
+Tagaro::RenderRuntime* Tagaro::RenderRuntime::instance()
+{
+	//may be called from destructors during shutdown
+	return g_runtime.isDestroyed() ? 0 : static_cast<Tagaro::RenderRuntime*>(g_runtime);
+}
+
+QList<Tagaro::RenderWorker*> Tagaro::RenderRuntime::removeAllWorkers()
+{
+	const QList<Tagaro::RenderWorker*> workers = m_workers;
+	m_workers.clear();
+	m_sourceOwners.clear();
+	foreach (Tagaro::RenderWorker* worker, workers)
+	{
+		worker->m_quit = true;
+	}
+	m_jobAvailable.wakeAll();
+	return workers;
+}
+
+int Tagaro::RenderRuntime::threadCount() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_workers.count();
+}
+
+bool Tagaro::RenderRuntime::isDeterministic() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_deterministic;
+}
+
+void Tagaro::RenderRuntime::setDeterministic(bool deterministic)
+{
+	m_mutex.lock();
+	if (m_deterministic == deterministic)
+	{
+		m_mutex.unlock();
+		return;
+	}
+	m_deterministic = deterministic;
+	if (!deterministic)
+	{
+		m_mutex.unlock();
+		setThreadCount(Tagaro::Settings::renderingThreadCount());
+		return;
+	}
+	const QList<Tagaro::RenderWorker*> workers = removeAllWorkers();
+	m_mutex.unlock();
+	foreach (Tagaro::RenderWorker* worker, workers)
+	{
+		worker->wait();
+	}
+	qDeleteAll(workers);
+}
+
+int Tagaro::RenderRuntime::processPendingJobs(int maxJobs)
+{
+	int count = 0;
+	while (maxJobs <= 0 || count < maxJobs)
+	{
+		m_mutex.lock();
+		const int p = m_deterministic ? nextPriorityClass() : -1;
+		if (p < 0)
+		{
+			m_mutex.unlock();
+			return count;
+		}
+		//same order as in takeJob(), without source affinity (there is only
+		//one thread)
+		Tagaro::RenderJob* job = m_queues[p].takeFirst();
+		--m_credits[p];
+		++m_runningJobs;
+		m_mutex.unlock();
+		executeJob(job);
+		++count;
+	}
+	return count;
+}
+
+void Tagaro::RenderRuntime::setThreadCount(int count)
+{
+	if (count <= 0)
+	{
+		count = qMax(1, QThread::idealThreadCount());
+	}
+	QList<Tagaro::RenderWorker*> removedWorkers;
+	m_mutex.lock();
+	if (m_deterministic)
+	{
+		//threads are restarted when the deterministic mode is disabled
+		m_mutex.unlock();
+		return;
+	}
+	while (m_workers.count() < count)
+	{
+		Tagaro::RenderWorker* worker = new Tagaro::RenderWorker(this);
+		m_workers << worker;
+		worker->start();
+	}
+	while (m_workers.count() > count)
+	{
+		Tagaro::RenderWorker* worker = m_workers.takeLast();
+		worker->m_quit = true;
+		removedWorkers << worker;
+		//the sources of this worker are free for the others
+		QHash<const Tagaro::GraphicsSource*, Tagaro::RenderWorker*>::iterator it = m_sourceOwners.begin();
+		while (it != m_sourceOwners.end())
+		{
+			if (it.value() == worker)
+			{
+				it = m_sourceOwners.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+	m_jobAvailable.wakeAll();
+	m_mutex.unlock();
+	//wait for removed workers to finish their current job
+	foreach (Tagaro::RenderWorker* worker, removedWorkers)
+	{
+		worker->wait();
+	}
+	qDeleteAll(removedWorkers);
+}
+
+void Tagaro::RenderRuntime::enqueue(Tagaro::RenderJob* job)
+{
+	QMutexLocker locker(&m_mutex);
+	job->m_enqueueTime = m_clock.elapsed();
+	m_queues[job->m_priority] << job;
+	m_jobAvailable.wakeOne();
+}
+
+void Tagaro::RenderRuntime::setPriority(Tagaro::RenderJob* job, Tagaro::RenderScheduler::Priority priority)
+{
+	QMutexLocker locker(&m_mutex);
+	if (job->m_priority == priority)
+	{
+		return;
+	}
+	//only waiting jobs can be moved (the enqueue time is kept, so that the
+	//latency statistics include the time spent in the old class)
+	if (m_queues[job->m_priority].removeOne(job))
+	{
+		m_queues[priority] << job;
+	}
+	job->m_priority = priority;
+}
+
+bool Tagaro::RenderRuntime::cancel(Tagaro::RenderJob* job)
+{
+	QMutexLocker locker(&m_mutex);
+	if (m_queues[job->m_priority].removeOne(job))
+	{
+		++m_cancelledJobs;
+		return true;
+	}
+	return false;
+}
+
+Tagaro::RenderScheduler::Statistics Tagaro::RenderRuntime::statistics() const
+{
+	QMutexLocker locker(&m_mutex);
+	Tagaro::RenderScheduler::Statistics stats;
+	for (int p = 0; p < Tagaro::RenderScheduler::PriorityCount; ++p)
+	{
+		stats.queueDepth[p] = m_queues[p].count();
+		stats.averageLatency[p] = m_latencyCount[p] ? qreal(m_latencySum[p]) / m_latencyCount[p] : 0.0;
+		stats.maximumLatency[p] = m_latencyMax[p];
+	}
+	stats.runningJobs = m_runningJobs;
+	stats.finishedJobs = m_finishedJobs;
+	stats.cancelledJobs = m_cancelledJobs;
+	stats.stolenJobs = m_stolenJobs;
+	return stats;
+}
+
+//Chooses the priority class of the next job (weighted round-robin over the
+//priority classes). Requires a locked mutex.
+int Tagaro::RenderRuntime::nextPriorityClass()
+{
+	bool hasJobs = false;
+	for (int p = 0; p < Tagaro::RenderScheduler::PriorityCount; ++p)
+	{
+		if (m_queues[p].isEmpty())
+		{
+			continue;
+		}
+		hasJobs = true;
+		if (m_credits[p] > 0)
+		{
+			return p;
+		}
+	}
+	if (!hasJobs)
+	{
+		return -1;
+	}
+	//all classes with pending jobs have used up their share -> next round
+	for (int p = 0; p < Tagaro::RenderScheduler::PriorityCount; ++p)
+	{
+		m_credits[p] = g_priorityWeights[p];
+	}
+	return nextPriorityClass();
+}
+
+void Tagaro::RenderRuntime::releaseSource(const Tagaro::GraphicsSource* source)
+{
+	//do not start the runtime just for this
+	if (!g_runtime.exists() || g_runtime.isDestroyed())
+	{
+		return;
+	}
+	QMutexLocker locker(&g_runtime->m_mutex);
+	g_runtime->m_sourceOwners.remove(source);
+}
+
+//Requires a locked mutex.
+int Tagaro::RenderRuntime::affineJobIndex(int priorityClass, Tagaro::RenderWorker* worker) const
+{
+	//prefer jobs for own sources, then jobs for sources without owner, and
+	//only then steal jobs from other workers
+	const QList<Tagaro::RenderJob*>& queue = m_queues[priorityClass];
+	const int count = qMin(queue.count(), g_affinityWindow);
+	int unownedIndex = -1;
+	for (int i = 0; i < count; ++i)
+	{
+		Tagaro::RenderWorker* owner = m_sourceOwners.value(queue[i]->m_key.m_source);
+		if (owner == worker)
+		{
+			return i;
+		}
+		if (!owner && unownedIndex < 0)
+		{
+			unownedIndex = i;
+		}
+	}
+	return unownedIndex >= 0 ? unownedIndex : 0;
+}
+
+Tagaro::RenderJob* Tagaro::RenderRuntime::takeJob(Tagaro::RenderWorker* worker)
+{
+	QMutexLocker locker(&m_mutex);
+	while (!worker->m_quit)
+	{
+		const int p = nextPriorityClass();
+		if (p >= 0)
+		{
+			Tagaro::RenderJob* job = m_queues[p].takeAt(affineJobIndex(p, worker));
+			//A stolen job does not transfer the ownership of its source.
+			//Otherwise, the ownership of a busy source would flip between
+			//the workers all the time.
+			Tagaro::RenderWorker*& owner = m_sourceOwners[job->m_key.m_source];
+			if (!owner)
+			{
+				owner = worker;
+			}
+			else if (owner != worker)
+			{
+				++m_stolenJobs;
+			}
+			--m_credits[p];
+			++m_runningJobs;
+			return job;
+		}
+		m_jobAvailable.wait(&m_mutex);
+	}
+	return 0;
+}
+
+void Tagaro::RenderRuntime::finishJob(Tagaro::RenderJob* job, bool rendered)
+{
+	QMutexLocker locker(&m_mutex);
+	if (rendered)
+	{
+		const int p = job->m_priority;
+		const qint64 latency = m_clock.elapsed() - job->m_enqueueTime;
+		++m_latencyCount[p];
+		m_latencySum[p] += latency;
+		m_latencyMax[p] = qMax(m_latencyMax[p], latency);
+		++m_finishedJobs;
+	}
+	else
+	{
+		++m_cancelledJobs;
+	}
+	--m_runningJobs;
+}
+
+void Tagaro::RenderRuntime::executeJob(Tagaro::RenderJob* job)
+{
+	//The job is always sent back (even if cancelled) because the receiver of
+	//the completion queue owns it.
+	QList<QImage> results;
+	const Tagaro::RenderJobKey& key = job->m_key;
+	const bool cancelled = job->m_cancelled;
+	{
+		Tagaro::RenderTraceScope trace(job->m_elements.count() == 1 ? "render" : "render batch", key.m_element, key.m_size);
+		if (cancelled)
+		{
+			//drop job without rendering
+			trace.setOutcome(Tagaro::RenderTrace::Cancelled);
+		}
+		else if (!key.m_source)
+		{
+			QImage result(key.m_size, QImage::Format_ARGB32_Premultiplied);
+			result.fill(QColor(Qt::transparent).rgba());
+			for (int i = 0; i < job->m_elements.count(); ++i)
+			{
+				results << result;
+			}
+		}
+		else if (job->m_elements.count() == 1)
+		{
+			results << key.m_source->elementImage(key.m_element, key.m_size, key.m_processingInstruction, false);
+		}
+		else
+		{
+			results = key.m_source->elementImages(job->m_elements, key.m_size, key.m_processingInstruction);
+		}
+	}
+	//build the hit test masks here to take this work off the GUI thread
+	QList<Tagaro::AlphaMask> masks;
+	foreach (const QImage& result, results)
+	{
+		masks << Tagaro::AlphaMask(result, job->m_alphaThreshold);
+	}
+	job->m_results = results;
+	job->m_masks = masks;
+	finishJob(job, !cancelled);
+	//the job may be deleted by the receiver as soon as it is pushed
+	job->m_completionQueue->push(job);
+}
+
+//END Tagaro::RenderRuntime
+//BEGIN Tagaro::RenderWorker
+
+void Tagaro::RenderWorker::run()
+{
+	while (Tagaro::RenderJob* job = m_runtime->takeJob(this))
+	{
+		m_runtime->executeJob(job);
+	}
+}
+
+//END Tagaro::RenderWorker
+//BEGIN Tagaro::RenderCompletionQueue
+
+void Tagaro::RenderCompletionQueue::push(Tagaro::RenderJob* job)
+{
+	Tagaro::RenderJob* head;
+	do
+	{
+		head = m_head;
+		job->m_next = head;
+	}
+	while (!m_head.testAndSetOrdered(head, job));
+	//If the queue was not empty, the receiver has been notified already, and
+	//will take this job together with the previous ones.
+	if (!head)
+	{
+		QCoreApplication::postEvent(m_receiver, new QEvent(EventType));
+	}
+}
+
+QList<Tagaro::RenderJob*> Tagaro::RenderCompletionQueue::takeAll()
+{
+	QList<Tagaro::RenderJob*> jobs;
+	Tagaro::RenderJob* job = m_head.fetchAndStoreOrdered(0);
+	//the stack is in reverse order of completion
+	for (; job; job = job->m_next)
+	{
+		jobs.prepend(job);
+	}
+	return jobs;
+}
+
+//END Tagaro::RenderCompletionQueue
@@ -0,0 +1,133 @@
+/***************************************************************************
+ *   Copyright 2011 Stefan Majewsky <majewsky@gmx.net>                     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef TAGARO_RENDERSCHEDULER_H
+#define TAGARO_RENDERSCHEDULER_H
+
+#include <QtCore/QtGlobal>
+
+#include <libtagaro_export.h>
+
+namespace Tagaro {
+
+/**
+ * @class Tagaro::RenderScheduler renderscheduler.h <Tagaro/RenderScheduler>
+ *
+ * This class exposes the properties of the worker threads which render
+ * pixmaps for Tagaro::SpriteClient instances (if rendering threads are enabled
+ * in Tagaro::Settings).
+ *
+ * The rendering threads are owned by Tagaro, and do not share their workload
+ * with QThreadPool::globalInstance(). Rendering jobs are sorted into multiple
+ * priority classes. Jobs from more urgent classes are preferred, but each
+ * class receives a fixed share of the rendering time when multiple classes
+ * have pending jobs, so that less urgent jobs cannot starve.
+ *
+ * Within a priority class, each thread prefers jobs for the graphics sources
+ * which it has rendered recently, and only takes jobs for sources of other
+ * threads if there is nothing else to do. Graphics sources with expensive
+ * per-thread state (e.g. one parsed SVG document per concurrent renderer)
+ * therefore need this state only for the threads which actually render them in
+ * parallel.
+ *
+ * Because there is only one set of rendering threads, all methods in this
+ * class are static.
+ */
+class TAGARO_EXPORT RenderScheduler
+{
+	public:
+		///Priority classes for rendering jobs, from most urgent to least urgent.
+		enum Priority
+		{
+			///The job renders a pixmap which is visible right now.
+			VisiblePriority = 0,
+			///The job renders a pixmap which will probably be visible soon.
+			NearlyVisiblePriority,
+			///The job renders a pixmap which might be needed later.
+			PrefetchPriority,
+			///The job fills the caches with pixmaps which are not known to be
+			///needed at all.
+			WarmupPriority
+		};
+		///The number of priority classes.
+		enum { PriorityCount = WarmupPriority + 1 };
+
+		///Statistics about the rendering jobs. Latencies are measured from
+		///the time when the job is scheduled until it is finished.
+		struct Statistics
+		{
+			///the number of jobs which are waiting in each priority class
+			int queueDepth[PriorityCount];
+			///the average latency of jobs in each priority class (in ms)
+			qreal averageLatency[PriorityCount];
+			///the maximum latency of jobs in each priority class (in ms)
+			qreal maximumLatency[PriorityCount];
+			///the number of jobs which are running right now
+			int runningJobs;
+			///the number of jobs which have been finished
+			quint64 finishedJobs;
+			///the number of jobs which have been cancelled before they could
+			///be started
+			quint64 cancelledJobs;
+			///the number of jobs which have been taken by a thread although
+			///another thread has recently rendered something for the same
+			///graphics source
+			quint64 stolenJobs;
+		};
+
+		///@return the number of rendering threads
+		static int threadCount();
+		///Sets the number of rendering threads. If the given @a count is not
+		///positive, one thread per CPU core is used. The default is taken from
+		///Tagaro::Settings::renderingThreadCount().
+		///
+		///@note If threads have to be removed, this call blocks until these
+		///threads have finished their current job.
+		static void setThreadCount(int count);
+		///@return statistics about the rendering jobs
+		static Tagaro::RenderScheduler::Statistics statistics();
+
+		///@return whether the deterministic mode is enabled
+		///@see setDeterministic
+		static bool isDeterministic();
+		///Enables or disables the deterministic mode, which is meant for
+		///reproducible measurements (e.g. when replaying a session recorded
+		///with the TAGARO_RECORD_FILE environment variable). In this mode,
+		///all rendering threads are stopped, and rendering jobs are only
+		///executed when processPendingJobs() is called. The jobs are then
+		///executed in the same order in which the threads would take them.
+		///When the mode is disabled again, the rendering threads are
+		///restarted as configured in Tagaro::Settings.
+		///@note This blocks until the running jobs have finished.
+		static void setDeterministic(bool deterministic);
+		///Executes pending rendering jobs in the calling thread (only in
+		///deterministic mode). If @a maxJobs is positive, at most this many
+		///jobs are executed, otherwise all of them. The results are delivered
+		///to the sprite clients by the event loop of the GUI thread.
+		///@return the number of executed jobs
+		static int processPendingJobs(int maxJobs = -1);
+	private:
+		class Private;
+		//prohibit instantiation etc.
+		RenderScheduler();
+		Q_DISABLE_COPY(RenderScheduler)
+};
+
+} //namespace Tagaro
+
+#endif // TAGARO_RENDERSCHEDULER_H
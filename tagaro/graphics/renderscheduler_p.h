@@ -0,0 +1,206 @@
+/***************************************************************************
+ *   Copyright 2011 Stefan Majewsky <majewsky@gmx.net>                     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef TAGARO_RENDERSCHEDULER_P_H
+#define TAGARO_RENDERSCHEDULER_P_H
+
+#include "renderscheduler.h"
+#include "alphamask_p.h"
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QAtomicPointer>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QEvent>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
+#include <QtGui/QImage>
+
+namespace Tagaro {
+
+class GraphicsSource;
+class RenderCompletionQueue;
+class RenderWorker;
+class SpriteFetcher;
+
+//Identifies a rendering operation. Identical requests (e.g. from multiple
+//clients showing the same frame, or from multiple fetchers) share one job.
+struct RenderJobKey
+{
+	const Tagaro::GraphicsSource* m_source;
+	QString m_element; //frame element key
+	QSize m_size;
+	QString m_processingInstruction;
+
+	inline bool operator==(const Tagaro::RenderJobKey& other) const
+	{
+		return m_source == other.m_source && m_element == other.m_element && m_size == other.m_size && m_processingInstruction == other.m_processingInstruction;
+	}
+};
+
+//This must be in the same namespace as RenderJobKey to be found by QHash.
+inline uint qHash(const Tagaro::RenderJobKey& key)
+{
+	return ::qHash(key.m_element) ^ ::qHash(qMakePair(key.m_size.width(), key.m_size.height()))
+		^ ::qHash(key.m_processingInstruction) ^ ::qHash(key.m_source);
+}
+
+//A rendering job, as shared between the RenderJobTable (in the GUI thread)
+//and the RenderRuntime (in the rendering threads). After the job has been
+//enqueued, only the cancellation flag may be modified freely. The priority and
+//the enqueue time are guarded by the runtime's mutex.
+//
+//A job may render multiple elements of the same source in the same size (e.g.
+//the frames of an animation strip) if the source supports batch rendering.
+//The key contains the first of these elements.
+struct RenderJob
+{
+	struct Waiter
+	{
+		Tagaro::SpriteFetcher* fetcher;
+		int frame;
+		int index; //in m_elements
+		int generation; //of the fetcher at the time of the request
+		Tagaro::RenderScheduler::Priority priority;
+	};
+
+	Tagaro::RenderJobKey m_key;
+	QStringList m_elements;
+	QList<Waiter> m_waiters;
+	QAtomicInt m_cancelled;
+
+	Tagaro::RenderCompletionQueue* m_completionQueue; //receives the finished job
+	Tagaro::RenderScheduler::Priority m_priority;
+	qint64 m_enqueueTime;
+
+	int m_alphaThreshold; //for the hit test masks (see Tagaro::AlphaMask)
+
+	QList<QImage> m_results; //set by the worker (one for each element)
+	QList<Tagaro::AlphaMask> m_masks; //set by the worker (one for each result)
+	Tagaro::RenderJob* m_next; //link in the completion queue
+
+	RenderJob(const Tagaro::RenderJobKey& key, Tagaro::RenderCompletionQueue* completionQueue, Tagaro::RenderScheduler::Priority priority) : m_key(key), m_elements(key.m_element), m_cancelled(0), m_completionQueue(completionQueue), m_priority(priority), m_enqueueTime(0), m_alphaThreshold(0), m_next(0) {}
+};
+
+//Collects finished jobs from the rendering threads without locking. When the
+//queue becomes non-empty, the receiver gets one event of type EventType, and
+//can then take all finished jobs at once. Jobs which have been cancelled while
+//they were held by a worker are returned as well (with a null result).
+class RenderCompletionQueue
+{
+	public:
+		static const QEvent::Type EventType = QEvent::User;
+
+		RenderCompletionQueue(QObject* receiver) : m_receiver(receiver), m_head(0) {}
+
+		//may be called from any thread
+		void push(Tagaro::RenderJob* job);
+		//Returns the finished jobs in order of completion. Must be called
+		//from the receiver's thread.
+		QList<Tagaro::RenderJob*> takeAll();
+	private:
+		QObject* m_receiver;
+		QAtomicPointer<Tagaro::RenderJob> m_head; //last finished job first
+};
+
+//Owns the rendering threads and the queues of pending rendering jobs.
+class RenderRuntime
+{
+	public:
+		RenderRuntime();
+		~RenderRuntime();
+		//Returns 0 after the runtime has been destroyed during shutdown.
+		static Tagaro::RenderRuntime* instance();
+
+		//Hands the given job to the rendering threads. The job is pushed into
+		//its completion queue (and ownership along with it) when it is
+		//finished.
+		void enqueue(Tagaro::RenderJob* job);
+		//Moves the given job into another priority class if it is still waiting.
+		void setPriority(Tagaro::RenderJob* job, Tagaro::RenderScheduler::Priority priority);
+		//Removes the given job from the queues. Returns true if the job was
+		//still waiting; the caller owns the job then. Otherwise, the job has
+		//been taken by a worker, and will be pushed into its completion queue.
+		bool cancel(Tagaro::RenderJob* job);
+		//Forgets the owner of the given source, which is about to be deleted
+		//(another source might be allocated at the same address later).
+		static void releaseSource(const Tagaro::GraphicsSource* source);
+
+		int threadCount() const;
+		void setThreadCount(int count);
+		Tagaro::RenderScheduler::Statistics statistics() const;
+		bool isDeterministic() const;
+		void setDeterministic(bool deterministic);
+		int processPendingJobs(int maxJobs);
+
+		//Called by the workers. takeJob() blocks until a job is available, and
+		//returns 0 if the worker shall quit.
+		Tagaro::RenderJob* takeJob(Tagaro::RenderWorker* worker);
+		void finishJob(Tagaro::RenderJob* job, bool rendered);
+		//Renders the given job (taken by takeJob() or processPendingJobs()),
+		//and pushes it into its completion queue.
+		void executeJob(Tagaro::RenderJob* job);
+	private:
+		//Stops all threads, and returns them. The caller must wait for them
+		//and delete them. Requires a locked mutex.
+		QList<Tagaro::RenderWorker*> removeAllWorkers();
+		//Returns the priority class from which the next job shall be taken,
+		//or -1 if no jobs are pending.
+		int nextPriorityClass();
+		//Returns the index of the job in the given class which the given
+		//worker should take.
+		int affineJobIndex(int priorityClass, Tagaro::RenderWorker* worker) const;
+
+		mutable QMutex m_mutex;
+		QWaitCondition m_jobAvailable;
+		QList<Tagaro::RenderWorker*> m_workers;
+		QElapsedTimer m_clock;
+
+		QList<Tagaro::RenderJob*> m_queues[Tagaro::RenderScheduler::PriorityCount];
+		//remaining share of each priority class in the current scheduling round
+		int m_credits[Tagaro::RenderScheduler::PriorityCount];
+		//The worker which has last rendered something for a source. Workers
+		//prefer jobs for their own sources, so that the sources need not
+		//create a renderer instance for every rendering thread.
+		QHash<const Tagaro::GraphicsSource*, Tagaro::RenderWorker*> m_sourceOwners;
+
+		bool m_deterministic;
+		int m_runningJobs;
+		quint64 m_finishedJobs, m_cancelledJobs, m_stolenJobs;
+		quint64 m_latencyCount[Tagaro::RenderScheduler::PriorityCount];
+		qint64 m_latencySum[Tagaro::RenderScheduler::PriorityCount];
+		qint64 m_latencyMax[Tagaro::RenderScheduler::PriorityCount];
+};
+
+class RenderWorker : public QThread
+{
+	public:
+		RenderWorker(Tagaro::RenderRuntime* runtime) : m_runtime(runtime), m_quit(false) {}
+	protected:
+		virtual void run();
+	private:
+		friend class Tagaro::RenderRuntime;
+		Tagaro::RenderRuntime* m_runtime;
+		bool m_quit; //guarded by the runtime's mutex
+};
+
+} //namespace Tagaro
+
+#endif // TAGARO_RENDERSCHEDULER_P_H
@@ -0,0 +1,195 @@
+/***************************************************************************
+ *   Copyright 2011 Stefan Majewsky <majewsky@gmx.net>                     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "rendertrace_p.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QFile>
+#include <QtCore/QThread>
+
+//Limits the memory used by long traces (about 64 bytes per event plus the
+//element names). Later events are counted, but not recorded.
+static const int g_maxEventCount = 1 << 20;
+
+Tagaro::RenderTrace::RenderTrace(const QString& path)
+	: m_path(path)
+	, m_droppedEvents(0)
+	, m_finished(false)
+{
+	m_clock.start();
+	qAddPostRoutine(writeFileAtExit);
+}
+
+static Tagaro::RenderTrace* createTrace()
+{
+	const QByteArray path = qgetenv("TAGARO_TRACE_FILE");
+	return path.isEmpty() ? 0 : new Tagaro::RenderTrace(QFile::decodeName(path));
+}
+
+Tagaro::RenderTrace* Tagaro::RenderTrace::instance()
+{
+	//The instance is never deleted because rendering threads may record
+	//events until the very end. (The initialization of function-local
+	//statics is thread-safe.)
+	static Tagaro::RenderTrace* trace = createTrace();
+	return trace;
+}
+
+qint64 Tagaro::RenderTrace::timestamp() const
+{
+	//QElapsedTimer::nsecsElapsed() needs Qt 4.8
+	return m_clock.elapsed() * 1000;
+}
+
+void Tagaro::RenderTrace::instant(const char* name, const QString& element, const QSize& size, Tagaro::RenderTrace::Outcome outcome)
+{
+	const Tagaro::RenderTrace::Event event = { name, 'i', timestamp(), 0, 0, element, size, outcome };
+	record(event);
+}
+
+void Tagaro::RenderTrace::complete(const char* name, qint64 startTime, const QString& element, const QSize& size, Tagaro::RenderTrace::Outcome outcome)
+{
+	const Tagaro::RenderTrace::Event event = { name, 'X', startTime, timestamp() - startTime, 0, element, size, outcome };
+	record(event);
+}
+
+void Tagaro::RenderTrace::record(const Tagaro::RenderTrace::Event& event)
+{
+	QMutexLocker locker(&m_mutex);
+	if (m_finished)
+	{
+		return;
+	}
+	if (m_events.count() >= g_maxEventCount)
+	{
+		++m_droppedEvents;
+		return;
+	}
+	m_events << event;
+	m_events.last().thread = threadIndex();
+}
+
+int Tagaro::RenderTrace::threadIndex()
+{
+	const Qt::HANDLE handle = QThread::currentThreadId();
+	QHash<Qt::HANDLE, int>::const_iterator it = m_threads.constFind(handle);
+	if (it != m_threads.constEnd())
+	{
+		return it.value();
+	}
+	const int index = m_threadNames.count();
+	m_threads.insert(handle, index);
+	QCoreApplication* app = QCoreApplication::instance();
+	if (app && QThread::currentThread() == app->thread())
+	{
+		m_threadNames << QLatin1String("GUI thread");
+	}
+	else
+	{
+		m_threadNames << QString::fromLatin1("Thread %1").arg(index);
+	}
+	return index;
+}
+
+static QByteArray jsonString(const QString& string)
+{
+	QByteArray result("\"");
+	const QByteArray utf8 = string.toUtf8();
+	for (int i = 0; i < utf8.size(); ++i)
+	{
+		const char c = utf8[i];
+		if (c == '"' || c == '\\')
+		{
+			result += '\\';
+			result += c;
+		}
+		else if (uchar(c) < 0x20)
+		{
+			result += "\\u00";
+			result += QByteArray::number(uchar(c), 16).rightJustified(2, '0');
+		}
+		else
+		{
+			result += c;
+		}
+	}
+	return result + '"';
+}
+
+void Tagaro::RenderTrace::writeFileAtExit()
+{
+	Tagaro::RenderTrace::instance()->writeFile();
+}
+
+void Tagaro::RenderTrace::writeFile()
+{
+	QMutexLocker locker(&m_mutex);
+	if (m_finished)
+	{
+		return;
+	}
+	m_finished = true;
+	QFile file(m_path);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+	{
+		qWarning("Tagaro::RenderTrace: Cannot write trace file %s", qPrintable(m_path));
+		return;
+	}
+	static const char* outcomeNames[] = { 0, "hit", "miss", "shared", "cancelled" };
+	const QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+	file.write("{\"traceEvents\":[\n");
+	//name the threads
+	for (int i = 0; i < m_threadNames.count(); ++i)
+	{
+		file.write("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":" + QByteArray::number(i)
+			+ ",\"args\":{\"name\":" + jsonString(m_threadNames[i]) + "}},\n");
+	}
+	foreach (const Tagaro::RenderTrace::Event& event, m_events)
+	{
+		QByteArray line("{\"name\":\"");
+		line += event.name;
+		line += "\",\"cat\":\"tagaro\",\"ph\":\"";
+		line += event.phase;
+		line += "\",\"ts\":" + QByteArray::number(event.timestamp);
+		if (event.phase == 'X')
+		{
+			line += ",\"dur\":" + QByteArray::number(event.duration);
+		}
+		else
+		{
+			line += ",\"s\":\"t\""; //thread-scoped instant event
+		}
+		line += ",\"pid\":" + pid + ",\"tid\":" + QByteArray::number(event.thread);
+		line += ",\"args\":{\"element\":" + jsonString(event.element);
+		line += ",\"size\":\"" + QByteArray::number(event.size.width()) + 'x' + QByteArray::number(event.size.height()) + '"';
+		if (event.outcome != NoOutcome)
+		{
+			line += ",\"outcome\":\"";
+			line += outcomeNames[event.outcome];
+			line += '"';
+		}
+		line += "}},\n";
+		file.write(line);
+	}
+	//the last entry carries the number of dropped events (and avoids a
+	//trailing comma)
+	file.write("{\"name\":\"dropped_events\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":0,\"args\":{\"count\":"
+		+ QByteArray::number(m_droppedEvents) + "}}\n");
+	file.write("],\"displayTimeUnit\":\"ms\"}\n");
+	m_events.clear();
+}
@@ -0,0 +1,126 @@
+/***************************************************************************
+ *   Copyright 2011 Stefan Majewsky <majewsky@gmx.net>                     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef TAGARO_RENDERTRACE_P_H
+#define TAGARO_RENDERTRACE_P_H
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QSize>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+namespace Tagaro {
+
+//Records the events of the rendering pipeline (rendering jobs, cache lookups,
+//pixmap deliveries) if the environment variable TAGARO_TRACE_FILE is set. The
+//events are written to the file named by this variable when the application
+//exits, in the trace event format which is understood by Chrome's
+//about:tracing page. All methods are thread-safe.
+class RenderTrace
+{
+	public:
+		enum Outcome
+		{
+			NoOutcome = 0,
+			CacheHit,
+			CacheMiss,
+			SharedJob, //request was attached to an identical pending job
+			Cancelled
+		};
+
+		//Returns 0 if tracing is disabled. This is cheap enough to be called
+		//for every event.
+		static Tagaro::RenderTrace* instance();
+		//use instance() instead
+		RenderTrace(const QString& path);
+
+		//microseconds since the start of the trace (with millisecond
+		//resolution)
+		qint64 timestamp() const;
+		//Records an event without duration.
+		void instant(const char* name, const QString& element, const QSize& size, Tagaro::RenderTrace::Outcome outcome = NoOutcome);
+		//Records an event which has started at the given timestamp, and ends now.
+		void complete(const char* name, qint64 startTime, const QString& element, const QSize& size, Tagaro::RenderTrace::Outcome outcome = NoOutcome);
+	private:
+		struct Event
+		{
+			const char* name;
+			char phase;
+			qint64 timestamp, duration;
+			int thread;
+			QString element;
+			QSize size;
+			Tagaro::RenderTrace::Outcome outcome;
+		};
+
+		void record(const Tagaro::RenderTrace::Event& event);
+		//Returns the index of the calling thread. Requires a locked mutex.
+		int threadIndex();
+		void writeFile();
+		static void writeFileAtExit();
+
+		QString m_path;
+		QElapsedTimer m_clock;
+		mutable QMutex m_mutex;
+		QVector<Tagaro::RenderTrace::Event> m_events;
+		int m_droppedEvents;
+		QHash<Qt::HANDLE, int> m_threads;
+		QStringList m_threadNames;
+		bool m_finished;
+};
+
+//Records a complete event for the lifetime of this object.
+class RenderTraceScope
+{
+	public:
+		RenderTraceScope(const char* name, const QString& element, const QSize& size)
+			: m_trace(Tagaro::RenderTrace::instance())
+			, m_name(name)
+			, m_startTime(0)
+			, m_outcome(Tagaro::RenderTrace::NoOutcome)
+		{
+			if (m_trace)
+			{
+				m_element = element;
+				m_size = size;
+				m_startTime = m_trace->timestamp();
+			}
+		}
+		~RenderTraceScope()
+		{
+			if (m_trace)
+			{
+				m_trace->complete(m_name, m_startTime, m_element, m_size, m_outcome);
+			}
+		}
+		inline void setOutcome(Tagaro::RenderTrace::Outcome outcome) { m_outcome = outcome; }
+	private:
+		Tagaro::RenderTrace* m_trace;
+		const char* m_name;
+		QString m_element;
+		QSize m_size;
+		qint64 m_startTime;
+		Tagaro::RenderTrace::Outcome m_outcome;
+};
+
+} //namespace Tagaro
+
+#endif // TAGARO_RENDERTRACE_P_H
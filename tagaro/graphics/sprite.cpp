@@ -19,19 +19,26 @@
 #include "sprite.h"
 #include "sprite_p.h"
 #include "graphicssource.h"
+#include "graphicssourceconfig.h"
+#include "renderrecorder_p.h"
+#include "rendertrace_p.h"
 #include "settings.h"
 
-#include <QtCore/QRunnable>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QSet>
-#include <QtCore/QThreadPool>
+#include <QtCore/QTimerEvent>
+#include <KDE/KGlobal>
 
 Tagaro::Sprite::Sprite()
-	: d(new Private)
+	: d(new Private(this))
 {
 }
 
-Tagaro::Sprite::Private::Private()
-	: m_source(0)
+Tagaro::Sprite::Private::Private(Tagaro::Sprite* q)
+	: q(q)
+	, m_source(0)
+	, m_registry(0)
+	, m_generation(0)
 {
 }
 
@@ -44,19 +51,35 @@ Tagaro::Sprite::~Sprite()
 	{
 		clients[i]->setSprite(0);
 	}
-	//delete own stuff
-	qDeleteAll(d->m_fetchers);
+	//delete own stuff (the fetchers are shared with other sprites)
 	delete d;
 }
 
 void Tagaro::Sprite::Private::addClient(Tagaro::SpriteClient* client)
 {
 	m_clients << client;
+	if (m_clients.count() == 1 && m_registry)
+	{
+		//the client will ask for a fetcher, so the mapping must be current
+		updateMapping();
+		m_registry->setSpriteUsed(q, true);
+	}
 }
 
 void Tagaro::Sprite::Private::removeClient(Tagaro::SpriteClient* client)
 {
-	m_clients.removeAll(client);
+	if (m_clients.removeAll(client) && m_clients.isEmpty() && m_registry)
+	{
+		m_registry->setSpriteUsed(q, false);
+	}
+}
+
+void Tagaro::Sprite::Private::updateMapping()
+{
+	if (m_registry && m_generation != m_registry->generation())
+	{
+		m_registry->mapSprite(q);
+	}
 }
 
 void Tagaro::Sprite::Private::setSource(const Tagaro::GraphicsSource* source, const QString& element)
@@ -65,15 +88,32 @@ void Tagaro::Sprite::Private::setSource(const Tagaro::GraphicsSource* source, co
 	{
 		m_source = source;
 		m_element = element;
-		foreach (Tagaro::SpriteFetcher* fetcher, m_fetchers)
+		//move clients to the fetchers for the new element (take a copy of
+		//m_clients because clients might remove themselves in the process)
+		const QList<Tagaro::SpriteClient*> clients = m_clients;
+		foreach (Tagaro::SpriteClient* client, clients)
 		{
-			fetcher->updateAllClients();
+			client->d->setFetcher(fetcher(client->renderSize(), client->processingInstruction()));
 		}
 	}
 }
 
+Tagaro::RenderJobKey Tagaro::Sprite::Private::fetcherKey(const QSize& size, const QString& processingInstruction) const
+{
+	const Tagaro::RenderJobKey key = { m_source, m_element, size, processingInstruction };
+	return key;
+}
+
+bool Tagaro::Sprite::Private::hasPixmap(const QSize& size, const QString& processingInstruction, int frame) const
+{
+	//sprites with clients are always mapped to the selected theme
+	Tagaro::SpriteFetcher* fetcher = Tagaro::SpriteFetcherPool::instance()->find(fetcherKey(size, processingInstruction));
+	return fetcher && fetcher->hasPixmap(frame);
+}
+
 QRectF Tagaro::Sprite::bounds(int frame) const
 {
+	d->updateMapping();
 	if (!d->m_source)
 	{
 		return QRectF();
@@ -89,11 +129,13 @@ bool Tagaro::Sprite::exists() const
 
 int Tagaro::Sprite::frameCount() const
 {
+	d->updateMapping();
 	return d->m_source ? d->m_source->frameCount(d->m_element) : -1;
 }
 
 QString Tagaro::Sprite::key() const
 {
+	d->updateMapping();
 	return d->m_element;
 }
 
@@ -103,62 +145,275 @@ Tagaro::SpriteFetcher* Tagaro::Sprite::Private::fetcher(const QSize& size, const
 	{
 		return 0;
 	}
-	Tagaro::SpriteFetcher*& fetcher = m_fetchers[qMakePair(size, processingInstruction)];
-	if (!fetcher)
-	{
-		fetcher = new Tagaro::SpriteFetcher(size, processingInstruction, this);
-	}
-	return fetcher;
+	return Tagaro::SpriteFetcherPool::instance()->fetcher(fetcherKey(size, processingInstruction));
 }
 
 QPixmap Tagaro::Sprite::pixmap(const QSize& size, int frame, const QString& processingInstruction) const
 {
+	if (Tagaro::RenderRecorder* recorder = Tagaro::RenderRecorder::instance())
+	{
+		recorder->record("pixmap", Tagaro::RenderRecorder::encode(d->providerKey()) + ' ' + QByteArray::number(size.width()) + ' '
+			+ QByteArray::number(size.height()) + ' ' + QByteArray::number(frame) + ' ' + Tagaro::RenderRecorder::encode(processingInstruction));
+	}
+	d->updateMapping();
 	if (!d->m_source || size.isEmpty())
 	{
 		return QPixmap();
 	}
-	return d->fetcher(size, processingInstruction)->cachePixmap(frame, QImage());
+	Tagaro::SpriteFetcher* fetcher = d->fetcher(size, processingInstruction);
+	return fetcher->cachePixmap(fetcher->normalizeFrame(frame), QImage());
+}
+
+void Tagaro::Sprite::requestPixmap(const QSize& size, int frame, const QString& processingInstruction, QObject* receiver, const char* member) const
+{
+	Tagaro::PixmapRequest* request = new Tagaro::PixmapRequest(const_cast<Tagaro::Sprite*>(this), receiver, member);
+	request->start(size, frame, processingInstruction);
+}
+
+Tagaro::PixmapRequest::PixmapRequest(Tagaro::Sprite* sprite, QObject* receiver, const char* member)
+	: Tagaro::SpriteClient(sprite)
+	, m_finished(false)
+{
+	//The connection is queued so that the receiver is never called from
+	//within requestPixmap().
+	connect(this, SIGNAL(pixmapReady(QPixmap)), receiver, member, Qt::QueuedConnection);
+	connect(receiver, SIGNAL(destroyed()), this, SLOT(deleteLater()));
+}
+
+void Tagaro::PixmapRequest::start(const QSize& size, int frame, const QString& processingInstruction)
+{
+	setFrame(frame);
+	setProcessingInstruction(processingInstruction);
+	setRenderSize(size);
+	//no pixmap will be fetched for an empty size
+	if (!m_finished && size.isEmpty())
+	{
+		receivePixmap(QPixmap());
+	}
+}
+
+void Tagaro::PixmapRequest::receivePixmap(const QPixmap& pixmap)
+{
+	if (m_finished)
+	{
+		return;
+	}
+	m_finished = true;
+	emit pixmapReady(pixmap);
+	deleteLater();
 }
 
 //BEGIN asynchronous pixmap serving
 
+K_GLOBAL_STATIC(Tagaro::RenderJobTable, g_renderJobTable)
+K_GLOBAL_STATIC(Tagaro::PixmapBudget, g_pixmapBudget)
+K_GLOBAL_STATIC(Tagaro::SpriteFetcherPool, g_spriteFetcherPool)
+
+Tagaro::SpriteFetcher::~SpriteFetcher()
+{
+	if (!g_renderJobTable.isDestroyed())
+	{
+		g_renderJobTable->withdraw(this, Tagaro::RenderJobTable::AllFrames);
+	}
+	if (!g_pixmapBudget.isDestroyed())
+	{
+		g_pixmapBudget->removeAll(this);
+	}
+}
+
 void Tagaro::SpriteFetcher::addClient(Tagaro::SpriteClient* client)
 {
-	m_clients << client;
+	//updateClient() puts the client into the right bucket
 	updateClient(client);
 }
 
 void Tagaro::SpriteFetcher::removeClient(Tagaro::SpriteClient* client)
 {
-	m_clients.removeAll(client);
+	const int frame = client->d->m_fetcherFrame;
+	QHash<int, QSet<Tagaro::SpriteClient*> >::iterator it = m_clients.find(frame);
+	if (it == m_clients.end() || !it->remove(client))
+	{
+		return;
+	}
+	if (!it->isEmpty())
+	{
+		//the remaining clients might need this frame less urgently
+		updateJobPriority(frame);
+		return;
+	}
+	//if no other client shows this frame, a pending rendering job for this
+	//frame is not needed anymore (e.g. because the client has been resized)
+	m_clients.erase(it);
+	Tagaro::PixmapBudget::instance()->setHeld(this, frame, false);
+	Tagaro::RenderJobTable::instance()->withdraw(this, frame);
+	releaseIfUnused();
+}
+
+void Tagaro::SpriteFetcher::moveClient(Tagaro::SpriteClient* client, int frame)
+{
+	QHash<int, QSet<Tagaro::SpriteClient*> >::iterator it = m_clients.find(client->d->m_fetcherFrame);
+	if (it != m_clients.end())
+	{
+		it->remove(client);
+		if (it->isEmpty())
+		{
+			m_clients.erase(it);
+			Tagaro::PixmapBudget::instance()->setHeld(this, client->d->m_fetcherFrame, false);
+		}
+	}
+	QSet<Tagaro::SpriteClient*>& bucket = m_clients[frame];
+	if (bucket.isEmpty())
+	{
+		Tagaro::PixmapBudget::instance()->setHeld(this, frame, true);
+	}
+	bucket.insert(client);
+	client->d->m_fetcherFrame = frame;
 }
 
-void Tagaro::SpriteFetcher::updateClient(Tagaro::SpriteClient* client)
+bool Tagaro::SpriteFetcher::hasPixmap(int frame) const
 {
-	const int frameCount = d->m_source->frameCount(d->m_element);
-	int frame = client->frame();
+	frame = normalizeFrame(frame);
+	return m_pixmapCache.contains(frame) || m_imageCache.contains(frame);
+}
+
+bool Tagaro::SpriteFetcher::isFrameHeld(int frame) const
+{
+	//empty buckets are removed immediately
+	return m_clients.contains(frame);
+}
+
+void Tagaro::SpriteFetcher::evictPixmap(int frame)
+{
+	m_pixmapCache.remove(frame);
+	m_imageCache.remove(frame);
+	m_maskCache.remove(frame);
+}
+
+void Tagaro::SpriteFetcher::clearPixmapCache()
+{
+	m_pixmapCache.clear();
+	m_imageCache.clear();
+	m_maskCache.clear();
+	Tagaro::PixmapBudget::instance()->removeAll(this);
+}
+
+void Tagaro::SpriteFetcher::releaseIfUnused()
+{
+	if (!m_clients.isEmpty() || !m_pixmapCache.isEmpty() || !m_imageCache.isEmpty())
+	{
+		return;
+	}
+	//Sprite::Private::fetcher() will create a new fetcher when this key is
+	//requested again. Deletion is deferred because this might be called from
+	//within one of our own methods.
+	Tagaro::SpriteFetcherPool::instance()->remove(this);
+	Tagaro::RenderJobTable::instance()->withdraw(this, Tagaro::RenderJobTable::AllFrames);
+	deleteLater();
+}
+
+void Tagaro::SpriteFetcher::releaseCache()
+{
+	//pixmaps which are shown by clients stay in the cache
+	QList<int> frames = m_pixmapCache.keys();
+	frames += m_imageCache.keys();
+	foreach (int frame, frames)
+	{
+		if (!isFrameHeld(frame))
+		{
+			evictPixmap(frame);
+			Tagaro::PixmapBudget::instance()->remove(this, frame);
+		}
+	}
+	releaseIfUnused();
+}
+
+void Tagaro::SpriteFetcher::updatePriority(Tagaro::SpriteClient* client)
+{
+	const int frame = client->d->m_fetcherFrame;
+	if (m_imageCache.contains(frame) && !m_pixmapCache.contains(frame))
+	{
+		//the client might need the pixmap now
+		if (client->deliveryMode() == Tagaro::SpriteClient::PixmapDelivery)
+		{
+			serveClient(client, frame);
+		}
+		return;
+	}
+	updateJobPriority(frame);
+}
+
+void Tagaro::SpriteFetcher::updateJobPriority(int frame)
+{
+	//only pending rendering jobs are affected
+	if (m_source && !hasPixmap(frame) && Tagaro::Settings::useRenderingThreads())
+	{
+		//if the job exists already, this only updates its priority
+		startJob(frame);
+	}
+}
+
+Tagaro::RenderScheduler::Priority Tagaro::SpriteFetcher::framePriority(int frame) const
+{
+	QHash<int, QSet<Tagaro::SpriteClient*> >::const_iterator it = m_clients.constFind(frame);
+	if (it == m_clients.constEnd())
+	{
+		return Tagaro::RenderScheduler::VisiblePriority;
+	}
+	Tagaro::RenderScheduler::Priority priority = Tagaro::RenderScheduler::WarmupPriority;
+	foreach (Tagaro::SpriteClient* client, *it)
+	{
+		priority = qMin(priority, client->renderPriority());
+	}
+	return priority;
+}
+
+int Tagaro::SpriteFetcher::normalizeFrame(int frame) const
+{
+	const int frameCount = m_source ? m_source->frameCount(m_element) : -1;
 	if (frameCount > 0)
 		frame %= frameCount;
+	else
+		//all frames of a non-animated sprite are rendered from the same element
+		frame = -1;
+	return frame;
+}
+
+void Tagaro::SpriteFetcher::updateClient(Tagaro::SpriteClient* client)
+{
+	const int frame = normalizeFrame(client->frame());
+	const int previousFrame = client->d->m_fetcherFrame;
+	const bool hadPreviousFrame = m_clients.value(previousFrame).contains(client);
+	moveClient(client, frame);
+	if (hadPreviousFrame && previousFrame != frame)
+	{
+		prefetch(previousFrame, frame);
+	}
 	//check if request can be served immediately
-	QHash<int, QPixmap>::const_iterator it = m_pixmapCache.find(frame);
-	if (it != m_pixmapCache.constEnd())
+	if (serveClient(client, frame))
 	{
-		client->d->receivePixmap(it.value());
 		return;
 	}
 	//no source available?
-	if (!d->m_source)
+	if (!m_source)
 	{
-		client->d->receivePixmap(QPixmap());
+		if (client->deliveryMode() == Tagaro::SpriteClient::ImageDelivery)
+		{
+			client->d->receiveImage(QImage());
+		}
+		else
+		{
+			client->d->receivePixmap(QPixmap());
+		}
 		return;
 	}
 	//check if request can be served without much hassle
-	const QString frameElement = d->m_source->frameElementKey(d->m_element, frame);
-	const QImage image = d->m_source->elementImage(frameElement, m_size, m_processingInstruction, true);
+	const QString frameElement = m_source->frameElementKey(m_element, frame);
+	const QImage image = m_source->elementImage(frameElement, m_size, m_processingInstruction, true);
 	if (!image.isNull())
 	{
-		//This also sends the pixmap to the client in question.
-		cachePixmap(frame, image);
+		//This also sends the image to the client in question. (The mask is
+		//only built when the first hit test needs it.)
+		cacheImage(frame, image, Tagaro::AlphaMask::deferred(image, alphaThreshold()));
 	}
 	else
 	{
@@ -167,113 +422,900 @@ void Tagaro::SpriteFetcher::updateClient(Tagaro::SpriteClient* client)
 	}
 }
 
-void Tagaro::SpriteFetcher::updateAllClients()
+void Tagaro::SpriteFetcher::detachSource()
 {
-	m_pixmapCache.clear();
-	//determine which frames are used
-	QSet<int> frames;
-	const int clientCount = m_clients.count();
-	for (int i = 0; i < clientCount; ++i)
+	m_source = 0;
+	clearPixmapCache();
+	//results of pending rendering jobs are obsolete
+	++m_generation;
+	Tagaro::RenderJobTable::instance()->withdraw(this, Tagaro::RenderJobTable::AllFrames);
+	if (m_clients.isEmpty())
 	{
-		frames << m_clients[i]->frame();
+		releaseIfUnused();
+		return;
+	}
+	//sort clients into buckets again (all frames are the same now)
+	const QList<QSet<Tagaro::SpriteClient*> > buckets = m_clients.values();
+	m_clients.clear();
+	foreach (const QSet<Tagaro::SpriteClient*>& bucket, buckets)
+	{
+		foreach (Tagaro::SpriteClient* client, bucket)
+		{
+			const int frame = normalizeFrame(client->frame());
+			m_clients[frame].insert(client);
+			client->d->m_fetcherFrame = frame;
+		}
+	}
+	//create rendering requests for all frames in use
+	const QList<int> frames = m_clients.keys();
+	foreach (int frame, frames)
+	{
+		startJob(frame);
+	}
+}
+
+Tagaro::RenderJobTable::RenderJobTable()
+	: m_completionQueue(this)
+	, m_deliveryTimerId(0)
+{
+}
+
+Tagaro::RenderJobTable::~RenderJobTable()
+{
+	//The rendering threads have been stopped already at this point (the
+	//RenderRuntime is created after the table, and destroyed before it).
+	qDeleteAll(m_releasedSources);
+}
+
+Tagaro::RenderJobTable* Tagaro::RenderJobTable::instance()
+{
+	return g_renderJobTable;
+}
+
+void Tagaro::RenderJobTable::releaseSource(Tagaro::GraphicsSource* source)
+{
+	if (!g_spriteFetcherPool.isDestroyed())
+	{
+		g_spriteFetcherPool->releaseSource(source);
+	}
+	if (g_renderJobTable.exists() && g_renderJobTable->m_sourceJobCounts.value(source) > 0)
+	{
+		g_renderJobTable->m_releasedSources << source;
+	}
+	else
+	{
+		Tagaro::RenderRuntime::releaseSource(source);
+		delete source;
+	}
+}
+
+void Tagaro::RenderJobTable::dropJob(Tagaro::RenderJob* job)
+{
+	Tagaro::GraphicsSource* source = const_cast<Tagaro::GraphicsSource*>(job->m_key.m_source);
+	delete job;
+	int& count = m_sourceJobCounts[source];
+	if (--count > 0)
+	{
+		return;
+	}
+	m_sourceJobCounts.remove(source);
+	if (m_releasedSources.removeOne(source))
+	{
+		Tagaro::RenderRuntime::releaseSource(source);
+		delete source;
+	}
+}
+
+void Tagaro::RenderJobTable::request(const Tagaro::RenderJobKey& key, Tagaro::SpriteFetcher* fetcher, int frame, Tagaro::RenderScheduler::Priority priority)
+{
+	Tagaro::RenderTrace* trace = Tagaro::RenderTrace::instance();
+	Tagaro::RenderJob*& job = m_jobs[key];
+	if (job)
+	{
+		//an identical job is running already -> wait for its result
+		if (trace)
+		{
+			trace->instant("enqueue", key.m_element, key.m_size, Tagaro::RenderTrace::SharedJob);
+		}
+		addWaiter(job, job->m_elements.indexOf(key.m_element), fetcher, frame, priority);
+		return;
+	}
+	if (trace)
+	{
+		trace->instant("enqueue", key.m_element, key.m_size);
+	}
+	job = new Tagaro::RenderJob(key, &m_completionQueue, priority);
+	job->m_alphaThreshold = fetcher->alphaThreshold();
+	addWaiter(job, 0, fetcher, frame, priority);
+	++m_sourceJobCounts[key.m_source];
+	Tagaro::RenderRuntime::instance()->enqueue(job);
+}
+
+void Tagaro::RenderJobTable::requestBatch(const QList<Tagaro::RenderJobKey>& keys, Tagaro::SpriteFetcher* fetcher, const QList<int>& frames, Tagaro::RenderScheduler::Priority priority)
+{
+	//elements which are being rendered already are not rendered again
+	QList<Tagaro::RenderJobKey> newKeys;
+	QList<int> newFrames;
+	for (int i = 0; i < keys.count(); ++i)
+	{
+		if (m_jobs.contains(keys[i]))
+		{
+			request(keys[i], fetcher, frames[i], priority);
+		}
+		else
+		{
+			newKeys << keys[i];
+			newFrames << frames[i];
+		}
+	}
+	if (newKeys.isEmpty())
+	{
+		return;
+	}
+	Tagaro::RenderTrace* trace = Tagaro::RenderTrace::instance();
+	Tagaro::RenderJob* job = new Tagaro::RenderJob(newKeys[0], &m_completionQueue, priority);
+	job->m_alphaThreshold = fetcher->alphaThreshold();
+	for (int i = 0; i < newKeys.count(); ++i)
+	{
+		if (trace)
+		{
+			trace->instant("enqueue", newKeys[i].m_element, newKeys[i].m_size);
+		}
+		if (i > 0)
+		{
+			job->m_elements << newKeys[i].m_element;
+		}
+		addWaiter(job, i, fetcher, newFrames[i], priority);
+		m_jobs.insert(newKeys[i], job);
+	}
+	++m_sourceJobCounts[newKeys[0].m_source];
+	Tagaro::RenderRuntime::instance()->enqueue(job);
+}
+
+void Tagaro::RenderJobTable::addWaiter(Tagaro::RenderJob* job, int index, Tagaro::SpriteFetcher* fetcher, int frame, Tagaro::RenderScheduler::Priority priority)
+{
+	const Tagaro::RenderJob::Waiter waiter = { fetcher, frame, index, fetcher->generation(), priority };
+	QList<Tagaro::RenderJob::Waiter>& waiters = job->m_waiters;
+	const int waiterCount = waiters.count();
+	for (int i = 0; i < waiterCount; ++i)
+	{
+		if (waiters[i].fetcher == fetcher && waiters[i].frame == frame && waiters[i].generation == waiter.generation)
+		{
+			//the fetcher has requested this frame already
+			waiters[i].priority = priority;
+			updatePriority(job);
+			return;
+		}
+	}
+	waiters << waiter;
+	if (!m_fetcherJobs.contains(fetcher, job))
+	{
+		m_fetcherJobs.insert(fetcher, job);
+	}
+	updatePriority(job);
+}
+
+void Tagaro::RenderJobTable::removeJob(Tagaro::RenderJob* job)
+{
+	Tagaro::RenderJobKey key = job->m_key;
+	foreach (const QString& element, job->m_elements)
+	{
+		key.m_element = element;
+		if (m_jobs.value(key) == job)
+		{
+			m_jobs.remove(key);
+		}
+	}
+	foreach (const Tagaro::RenderJob::Waiter& waiter, job->m_waiters)
+	{
+		m_fetcherJobs.remove(waiter.fetcher, job);
+	}
+}
+
+void Tagaro::RenderJobTable::updatePriority(Tagaro::RenderJob* job)
+{
+	Tagaro::RenderRuntime* runtime = Tagaro::RenderRuntime::instance();
+	if (!runtime)
+	{
+		return;
 	}
-	//create rendering requests for all frames in the set
-	QSet<int>::const_iterator it1 = frames.constBegin(), it2 = frames.constEnd();
-	for (; it1 != it2; ++it1)
+	Tagaro::RenderScheduler::Priority priority = Tagaro::RenderScheduler::WarmupPriority;
+	foreach (const Tagaro::RenderJob::Waiter& waiter, job->m_waiters)
 	{
-		startJob(*it1);
+		priority = qMin(priority, waiter.priority);
 	}
+	runtime->setPriority(job, priority);
 }
 
-namespace Tagaro {
-	class SpriteFetcherWorker : public QRunnable
+void Tagaro::RenderJobTable::withdraw(Tagaro::SpriteFetcher* fetcher, int frame)
+{
+	if (frame == AllFrames)
 	{
-		private:
-			const Tagaro::GraphicsSource* m_source;
-			QString m_element;
-			int m_frame;
-			QSize m_size;
-			QString m_processingInstruction;
-			Tagaro::SpriteFetcher* m_receiver;
-		public:
-			SpriteFetcherWorker(const Tagaro::GraphicsSource* source, const QString& element, int frame, const QSize& size, const QString& processingInstruction, Tagaro::SpriteFetcher* receiver)
-				: m_source(source)
-				  //DO NOT do the following in the worker thread. frameElementKey() is not guaranteed to be thread-safe!
-				, m_element(m_source->frameElementKey(element, frame))
-				, m_frame(frame)
-				, m_size(size)
-				, m_processingInstruction(processingInstruction)
-				, m_receiver(receiver)
+		for (int i = m_pendingPromotions.count() - 1; i >= 0; --i)
+		{
+			if (m_pendingPromotions[i].first == fetcher)
 			{
+				m_pendingPromotions.removeAt(i);
 			}
-			virtual void run()
+		}
+	}
+	const QList<Tagaro::RenderJob*> jobs = m_fetcherJobs.values(fetcher);
+	foreach (Tagaro::RenderJob* job, jobs)
+	{
+		QList<Tagaro::RenderJob::Waiter>& waiters = job->m_waiters;
+		bool changed = false, stillWaiting = false;
+		for (int i = waiters.count() - 1; i >= 0; --i)
+		{
+			if (waiters[i].fetcher != fetcher)
 			{
-				QImage result;
-				if (m_source)
-				{
-					result = m_source->elementImage(m_element, m_size, m_processingInstruction, false);
-				}
-				else
-				{
-					result = QImage(m_size, QImage::Format_ARGB32_Premultiplied);
-					result.fill(QColor(Qt::transparent).rgba());
-				}
-				QMetaObject::invokeMethod(m_receiver, "cachePixmap",
-					Q_ARG(int, m_frame), Q_ARG(QImage, result)
-				);
+				continue;
 			}
-	};
+			if (frame == AllFrames || waiters[i].frame == frame)
+			{
+				waiters.removeAt(i);
+				changed = true;
+			}
+			else
+			{
+				stillWaiting = true;
+			}
+		}
+		if (!changed)
+		{
+			continue;
+		}
+		if (!stillWaiting)
+		{
+			m_fetcherJobs.remove(fetcher, job);
+		}
+		if (!waiters.isEmpty())
+		{
+			//the remaining waiters might need the job less urgently
+			updatePriority(job);
+		}
+		else
+		{
+			//Nobody wants this job anymore. If a worker has taken it already,
+			//the worker will drop it or its result will be discarded. The job
+			//is removed from the table immediately, so that new requests will
+			//create a new job.
+			job->m_cancelled = 1;
+			removeJob(job);
+			Tagaro::RenderRuntime* runtime = Tagaro::RenderRuntime::instance();
+			if (runtime && runtime->cancel(job))
+			{
+				dropJob(job);
+			}
+		}
+	}
+}
+
+void Tagaro::RenderJobTable::customEvent(QEvent* event)
+{
+	if (event->type() == Tagaro::RenderCompletionQueue::EventType)
+	{
+		deliverResults();
+	}
+}
+
+void Tagaro::RenderJobTable::timerEvent(QTimerEvent* event)
+{
+	if (event->timerId() == m_deliveryTimerId)
+	{
+		deliverResults();
+	}
+}
+
+void Tagaro::RenderJobTable::deliverResults()
+{
+	//new results are delivered after those left over from the last run
+	m_finishedJobs += m_completionQueue.takeAll();
+	const int budget = Tagaro::Settings::deliveryTimeBudget();
+	QElapsedTimer timer;
+	timer.start();
+	while (!m_finishedJobs.isEmpty())
+	{
+		deliverResult(m_finishedJobs.takeFirst());
+		if (budget > 0 && timer.elapsed() >= budget)
+		{
+			break;
+		}
+	}
+	//convert images for clients which do not need them right now
+	const int conversionBudget = Tagaro::Settings::conversionTimeBudget();
+	timer.start();
+	while (!m_pendingPromotions.isEmpty())
+	{
+		const QPair<Tagaro::SpriteFetcher*, int> promotion = m_pendingPromotions.takeFirst();
+		promotion.first->promoteImage(promotion.second);
+		if (conversionBudget > 0 && timer.elapsed() >= conversionBudget)
+		{
+			break;
+		}
+	}
+	//A zero-interval timer fires once per event loop iteration, after the
+	//pending input and paint events have been processed.
+	const bool done = m_finishedJobs.isEmpty() && m_pendingPromotions.isEmpty();
+	if (done && m_deliveryTimerId)
+	{
+		killTimer(m_deliveryTimerId);
+		m_deliveryTimerId = 0;
+	}
+	else if (!done && !m_deliveryTimerId)
+	{
+		m_deliveryTimerId = startTimer(0);
+	}
+}
+
+void Tagaro::RenderJobTable::schedulePromotion(Tagaro::SpriteFetcher* fetcher, int frame)
+{
+	const QPair<Tagaro::SpriteFetcher*, int> promotion(fetcher, frame);
+	if (!m_pendingPromotions.contains(promotion))
+	{
+		m_pendingPromotions << promotion;
+	}
+	if (!m_deliveryTimerId)
+	{
+		m_deliveryTimerId = startTimer(0);
+	}
+}
+
+void Tagaro::RenderJobTable::deliverResult(Tagaro::RenderJob* job)
+{
+	//cancelled jobs have been removed from the table already
+	if (!job->m_cancelled)
+	{
+		removeJob(job);
+		//deliver result to all fetchers which have requested it, unless the
+		//request is obsolete
+		foreach (const Tagaro::RenderJob::Waiter& waiter, job->m_waiters)
+		{
+			if (waiter.generation != waiter.fetcher->generation())
+			{
+				continue;
+			}
+			const QImage image = job->m_results.value(waiter.index);
+			if (image.isNull())
+			{
+				//Rendering failed (e.g. because the source could not provide
+				//a renderer, or returned less images than requested). Do not
+				//cache a blank frame, and do not block the GUI thread by
+				//rendering again.
+				waiter.fetcher->renderingFailed(waiter.frame);
+			}
+			else
+			{
+				waiter.fetcher->cacheImage(waiter.frame, image, job->m_masks.value(waiter.index));
+			}
+		}
+	}
+	dropJob(job);
 }
 
 void Tagaro::SpriteFetcher::startJob(int frame)
 {
+	if (!m_source)
+	{
+		//cachePixmap() can handle this trivial case itself
+		cachePixmap(frame, QImage());
+		return;
+	}
+	const Tagaro::RenderJobKey key = {
+		m_source,
+		//DO NOT do this in the worker thread. frameElementKey() is not guaranteed to be thread-safe!
+		m_source->frameElementKey(m_element, frame),
+		m_size, m_processingInstruction
+	};
 	if (Tagaro::Settings::useRenderingThreads())
 	{
-		QThreadPool::globalInstance()->start(new Tagaro::SpriteFetcherWorker(d->m_source, d->m_element, frame, m_size, m_processingInstruction, this));
+		Tagaro::RenderJobTable::instance()->request(key, this, frame, framePriority(frame));
 	}
 	else
 	{
-		const QString element = d->m_source->frameElementKey(d->m_element, frame);
-		const QImage result = d->m_source->elementImage(element, m_size, m_processingInstruction, false);
-		cachePixmap(frame, result);
+		QImage result;
+		{
+			Tagaro::RenderTraceScope trace("render", key.m_element, m_size);
+			result = m_source->elementImage(key.m_element, m_size, m_processingInstruction, false);
+		}
+		if (result.isNull())
+		{
+			renderingFailed(frame);
+		}
+		else
+		{
+			cachePixmap(frame, result);
+		}
+	}
+}
+
+void Tagaro::SpriteFetcher::prefetch(int from, int to)
+{
+	if (!m_source || !Tagaro::Settings::useRenderingThreads())
+	{
+		return;
+	}
+	const int prefetchCount = m_source->config().prefetchFrameCount();
+	const int frameCount = m_source->frameCount(m_element);
+	if (prefetchCount <= 0 || frameCount <= 1)
+	{
+		return;
+	}
+	//is the client running through the animation (possibly wrapping around)?
+	int step;
+	if (to == (from + 1) % frameCount)
+	{
+		step = 1;
+	}
+	else if (from == (to + 1) % frameCount)
+	{
+		step = -1;
+	}
+	else
+	{
+		return;
+	}
+	//collect the next frames which are neither available nor requested by a client
+	QList<Tagaro::RenderJobKey> keys;
+	QList<int> frames;
+	for (int i = 1; i <= qMin(prefetchCount, frameCount - 1); ++i)
+	{
+		const int frame = (to + i * step + frameCount) % frameCount;
+		if (hasPixmap(frame) || m_clients.contains(frame))
+		{
+			continue;
+		}
+		const Tagaro::RenderJobKey key = {
+			m_source,
+			//frameElementKey() is not guaranteed to be thread-safe (see startJob())
+			m_source->frameElementKey(m_element, frame),
+			m_size, m_processingInstruction
+		};
+		keys << key;
+		frames << frame;
+	}
+	if (keys.isEmpty())
+	{
+		return;
+	}
+	Tagaro::RenderJobTable* table = Tagaro::RenderJobTable::instance();
+	if (keys.count() > 1 && m_source->supportsBatchRendering())
+	{
+		table->requestBatch(keys, this, frames, Tagaro::RenderScheduler::PrefetchPriority);
+	}
+	else
+	{
+		for (int i = 0; i < keys.count(); ++i)
+		{
+			table->request(keys[i], this, frames[i], Tagaro::RenderScheduler::PrefetchPriority);
+		}
 	}
 }
 
 QPixmap Tagaro::SpriteFetcher::cachePixmap(int frame, const QImage& image)
 {
+	Tagaro::RenderTraceScope trace("deliver", m_element, m_size);
 	//look in cache
-	QHash<int, QPixmap>::const_iterator it = m_pixmapCache.find(frame);
+	QHash<int, QPixmap>::const_iterator it = m_pixmapCache.constFind(frame);
 	if (it != m_pixmapCache.constEnd())
 	{
+		trace.setOutcome(Tagaro::RenderTrace::CacheHit);
+		Tagaro::PixmapBudget::instance()->touch(this, frame);
 		return it.value();
 	}
-	//convert or render image
-	QImage useImage = image;
-	if (image.isNull())
+	trace.setOutcome(Tagaro::RenderTrace::CacheMiss);
+	QPixmap result;
+	if (image.isNull() && m_imageCache.contains(frame))
+	{
+		result = convertImage(frame);
+	}
+	else
 	{
-		if (d->m_source)
+		//convert or render image
+		QImage useImage = image;
+		if (image.isNull())
 		{
-			const QString frameElement = d->m_source->frameElementKey(d->m_element, frame);
-			useImage = d->m_source->elementImage(frameElement, m_size, m_processingInstruction, false);
+			if (m_source)
+			{
+				const QString frameElement = m_source->frameElementKey(m_element, frame);
+				useImage = m_source->elementImage(frameElement, m_size, m_processingInstruction, false);
+				if (useImage.isNull())
+				{
+					//do not cache failures; the next request tries again
+					return QPixmap();
+				}
+			}
+			else
+			{
+				useImage = QImage(m_size, QImage::Format_ARGB32_Premultiplied);
+				useImage.fill(QColor(Qt::transparent).rgba());
+			}
+		}
+		result = QPixmap::fromImage(useImage);
+		m_pixmapCache.insert(frame, result);
+		m_maskCache.insert(frame, Tagaro::AlphaMask::deferred(useImage, alphaThreshold()));
+		qint64 bytes = qint64(result.width()) * result.height() * result.depth() / 8;
+		if (hasImageClients(frame))
+		{
+			m_imageCache.insert(frame, useImage);
+			bytes += useImage.byteCount();
 		}
 		else
 		{
-			useImage = QImage(m_size, QImage::Format_ARGB32_Premultiplied);
-			useImage.fill(QColor(Qt::transparent).rgba());
+			m_imageCache.remove(frame);
 		}
+		Tagaro::PixmapBudget::instance()->insert(this, frame, bytes);
 	}
-	const QPixmap result = QPixmap::fromImage(useImage);
-	m_pixmapCache.insert(frame, result);
-	//if this frame has been requested by some clients, send it out
-	const int clientCount = m_clients.count();
-	for (int i = 0; i < clientCount; ++i)
+	//if this frame has been requested by some clients, send it out (take a
+	//copy of the bucket because clients may change their frame in the
+	//process)
+	const QSet<Tagaro::SpriteClient*> clients = m_clients.value(frame);
+	foreach (Tagaro::SpriteClient* client, clients)
 	{
-		m_clients[i]->d->receivePixmap(result);
+		serveClient(client, frame);
 	}
 	//done
 	return result;
 }
 
+void Tagaro::SpriteFetcher::cacheImage(int frame, const QImage& image, const Tagaro::AlphaMask& mask)
+{
+	if (m_pixmapCache.contains(frame))
+	{
+		//replace the previous pixmap
+		m_pixmapCache.remove(frame);
+	}
+	m_imageCache.insert(frame, image);
+	m_maskCache.insert(frame, mask);
+	Tagaro::PixmapBudget::instance()->insert(this, frame, image.byteCount());
+	const QSet<Tagaro::SpriteClient*> clients = m_clients.value(frame);
+	foreach (Tagaro::SpriteClient* client, clients)
+	{
+		serveClient(client, frame);
+	}
+}
+
+void Tagaro::SpriteFetcher::renderingFailed(int frame)
+{
+	const QSet<Tagaro::SpriteClient*> clients = m_clients.value(frame);
+	foreach (Tagaro::SpriteClient* client, clients)
+	{
+		client->d->m_alphaMask = Tagaro::AlphaMask();
+		if (client->deliveryMode() == Tagaro::SpriteClient::ImageDelivery)
+		{
+			client->d->receiveImage(QImage());
+		}
+		else
+		{
+			client->d->receivePixmap(QPixmap());
+		}
+	}
+}
+
+int Tagaro::SpriteFetcher::alphaThreshold() const
+{
+	//without a source, only transparent pixmaps are delivered anyway
+	return m_source ? m_source->config().alphaThreshold() : 1;
+}
+
+void Tagaro::SpriteFetcher::promoteImage(int frame)
+{
+	if (!m_imageCache.contains(frame) || m_pixmapCache.contains(frame))
+	{
+		//converted or evicted in the meantime
+		return;
+	}
+	convertImage(frame);
+	const QSet<Tagaro::SpriteClient*> clients = m_clients.value(frame);
+	foreach (Tagaro::SpriteClient* client, clients)
+	{
+		serveClient(client, frame);
+	}
+}
+
+QPixmap Tagaro::SpriteFetcher::convertImage(int frame)
+{
+	const QImage image = m_imageCache.value(frame);
+	const QPixmap pixmap = QPixmap::fromImage(image);
+	m_pixmapCache.insert(frame, pixmap);
+	qint64 bytes = qint64(pixmap.width()) * pixmap.height() * pixmap.depth() / 8;
+	//keep the image for clients which want images (reading it back from the
+	//pixmap would be a server round-trip on X11)
+	if (hasImageClients(frame))
+	{
+		bytes += image.byteCount();
+	}
+	else
+	{
+		m_imageCache.remove(frame);
+	}
+	Tagaro::PixmapBudget::instance()->insert(this, frame, bytes);
+	return pixmap;
+}
+
+bool Tagaro::SpriteFetcher::hasImageClients(int frame) const
+{
+	foreach (Tagaro::SpriteClient* client, m_clients.value(frame))
+	{
+		if (client->deliveryMode() == Tagaro::SpriteClient::ImageDelivery)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Tagaro::SpriteFetcher::serveClient(Tagaro::SpriteClient* client, int frame)
+{
+	const bool wantsImage = client->deliveryMode() == Tagaro::SpriteClient::ImageDelivery;
+	//the mask is shared by all clients showing this frame
+	const Tagaro::AlphaMask mask = m_maskCache.value(frame);
+	QHash<int, QPixmap>::const_iterator pit = m_pixmapCache.constFind(frame);
+	if (pit != m_pixmapCache.constEnd())
+	{
+		Tagaro::PixmapBudget::instance()->touch(this, frame);
+		client->d->m_alphaMask = mask;
+		if (wantsImage)
+		{
+			QHash<int, QImage>::const_iterator iit = m_imageCache.constFind(frame);
+			if (iit == m_imageCache.constEnd())
+			{
+				//The image has been dropped because nobody wanted it at the
+				//time of the conversion. Read it back only once.
+				const QImage image = pit.value().toImage();
+				iit = m_imageCache.insert(frame, image);
+				Tagaro::PixmapBudget::instance()->insert(this, frame, qint64(pit.value().width()) * pit.value().height() * pit.value().depth() / 8 + image.byteCount());
+			}
+			client->d->receiveImage(iit.value());
+		}
+		else
+		{
+			client->d->receivePixmap(pit.value());
+		}
+		return true;
+	}
+	QHash<int, QImage>::const_iterator iit = m_imageCache.constFind(frame);
+	if (iit == m_imageCache.constEnd())
+	{
+		return false;
+	}
+	Tagaro::PixmapBudget::instance()->touch(this, frame);
+	if (wantsImage)
+	{
+		client->d->m_alphaMask = mask;
+		client->d->receiveImage(iit.value());
+		return true;
+	}
+	//Converting into a pixmap is expensive (e.g. on X11, it uploads the image
+	//to the X server), so this is only done right away for visible clients.
+	//The others are served within the conversion time budget.
+	if (client->renderPriority() == Tagaro::RenderScheduler::VisiblePriority)
+	{
+		client->d->m_alphaMask = mask;
+		client->d->receivePixmap(convertImage(frame));
+	}
+	else
+	{
+		Tagaro::RenderJobTable::instance()->schedulePromotion(this, frame);
+	}
+	return true;
+}
+
 //END asynchronous pixmap serving
+//BEGIN fetcher sharing
+
+Tagaro::SpriteFetcherPool::~SpriteFetcherPool()
+{
+	qDeleteAll(m_fetchers);
+	qDeleteAll(m_detachedFetchers);
+}
+
+Tagaro::SpriteFetcherPool* Tagaro::SpriteFetcherPool::instance()
+{
+	return g_spriteFetcherPool;
+}
+
+Tagaro::SpriteFetcher* Tagaro::SpriteFetcherPool::find(const Tagaro::RenderJobKey& key) const
+{
+	return m_fetchers.value(key);
+}
+
+Tagaro::SpriteFetcher* Tagaro::SpriteFetcherPool::fetcher(const Tagaro::RenderJobKey& key)
+{
+	Tagaro::SpriteFetcher*& fetcher = m_fetchers[key];
+	if (!fetcher)
+	{
+		fetcher = new Tagaro::SpriteFetcher(key);
+	}
+	return fetcher;
+}
+
+void Tagaro::SpriteFetcherPool::remove(Tagaro::SpriteFetcher* fetcher)
+{
+	//the fetcher might have been detached already (see releaseSource())
+	const Tagaro::RenderJobKey key = fetcher->key();
+	if (m_fetchers.value(key) == fetcher)
+	{
+		m_fetchers.remove(key);
+	}
+	else
+	{
+		m_detachedFetchers.removeAll(fetcher);
+	}
+}
+
+void Tagaro::SpriteFetcherPool::releaseSource(const Tagaro::GraphicsSource* source)
+{
+	QHash<Tagaro::RenderJobKey, Tagaro::SpriteFetcher*>::iterator it = m_fetchers.begin();
+	while (it != m_fetchers.end())
+	{
+		if (it.key().m_source != source)
+		{
+			++it;
+			continue;
+		}
+		//Sprites have usually been moved to another source at this point.
+		//If not, the remaining clients get transparent pixmaps from now on.
+		//The fetcher stays in the pool until it is not used anymore.
+		Tagaro::SpriteFetcher* fetcher = it.value();
+		it = m_fetchers.erase(it);
+		m_detachedFetchers << fetcher;
+		fetcher->detachSource();
+	}
+}
+
+void Tagaro::SpriteFetcherPool::releaseElements(const QSet<QPair<const Tagaro::GraphicsSource*, QString> >& elements)
+{
+	//take a copy because fetchers might remove themselves in the process
+	const QList<Tagaro::SpriteFetcher*> fetchers = m_fetchers.values();
+	foreach (Tagaro::SpriteFetcher* fetcher, fetchers)
+	{
+		const Tagaro::RenderJobKey key = fetcher->key();
+		if (elements.contains(qMakePair(key.m_source, key.m_element)))
+		{
+			fetcher->releaseCache();
+		}
+	}
+}
+
+//END fetcher sharing
+//BEGIN pixmap memory budget
+
+Tagaro::PixmapBudget* Tagaro::PixmapBudget::instance()
+{
+	return g_pixmapBudget;
+}
+
+void Tagaro::PixmapBudget::insert(Tagaro::SpriteFetcher* fetcher, int frame, qint64 bytes)
+{
+	const EntryKey key(fetcher, frame);
+	//replace old entry
+	forget(key);
+	m_usage += bytes;
+	m_fetcherFrames[fetcher].insert(frame);
+	if (fetcher->isFrameHeld(frame))
+	{
+		m_heldEntries.insert(key, bytes);
+	}
+	else
+	{
+		const Entry entry = { key, bytes };
+		m_index.insert(key, m_entries.insert(m_entries.end(), entry));
+	}
+	evict();
+}
+
+void Tagaro::PixmapBudget::touch(Tagaro::SpriteFetcher* fetcher, int frame)
+{
+	//held entries are not in the eviction order
+	QHash<EntryKey, QLinkedList<Entry>::iterator>::iterator it = m_index.find(EntryKey(fetcher, frame));
+	if (it != m_index.end())
+	{
+		const Entry entry = *it.value();
+		m_entries.erase(it.value());
+		it.value() = m_entries.insert(m_entries.end(), entry);
+	}
+}
+
+void Tagaro::PixmapBudget::remove(Tagaro::SpriteFetcher* fetcher, int frame)
+{
+	forget(EntryKey(fetcher, frame));
+	QHash<Tagaro::SpriteFetcher*, QSet<int> >::iterator it = m_fetcherFrames.find(fetcher);
+	if (it != m_fetcherFrames.end())
+	{
+		it->remove(frame);
+		if (it->isEmpty())
+		{
+			m_fetcherFrames.erase(it);
+		}
+	}
+}
+
+void Tagaro::PixmapBudget::removeAll(Tagaro::SpriteFetcher* fetcher)
+{
+	const QSet<int> frames = m_fetcherFrames.take(fetcher);
+	foreach (int frame, frames)
+	{
+		forget(EntryKey(fetcher, frame));
+	}
+}
+
+void Tagaro::PixmapBudget::forget(const EntryKey& key)
+{
+	QHash<EntryKey, QLinkedList<Entry>::iterator>::iterator it = m_index.find(key);
+	if (it != m_index.end())
+	{
+		m_usage -= it.value()->bytes;
+		m_entries.erase(it.value());
+		m_index.erase(it);
+		return;
+	}
+	QHash<EntryKey, qint64>::iterator hit = m_heldEntries.find(key);
+	if (hit != m_heldEntries.end())
+	{
+		m_usage -= hit.value();
+		m_heldEntries.erase(hit);
+	}
+}
+
+void Tagaro::PixmapBudget::setHeld(Tagaro::SpriteFetcher* fetcher, int frame, bool held)
+{
+	const EntryKey key(fetcher, frame);
+	if (held)
+	{
+		QHash<EntryKey, QLinkedList<Entry>::iterator>::iterator it = m_index.find(key);
+		if (it != m_index.end())
+		{
+			m_heldEntries.insert(key, it.value()->bytes);
+			m_entries.erase(it.value());
+			m_index.erase(it);
+		}
+	}
+	else
+	{
+		//The pixmap has just been shown, so it is the most recently used one.
+		//It is not evicted before the next insert().
+		QHash<EntryKey, qint64>::iterator it = m_heldEntries.find(key);
+		if (it != m_heldEntries.end())
+		{
+			const Entry entry = { key, it.value() };
+			m_index.insert(key, m_entries.insert(m_entries.end(), entry));
+			m_heldEntries.erase(it);
+		}
+	}
+}
+
+void Tagaro::PixmapBudget::evict()
+{
+	const qint64 budget = qint64(Tagaro::Settings::pixmapCacheSize()) << 20;
+	QList<Tagaro::SpriteFetcher*> affectedFetchers;
+	//pixmaps which are shown by clients are not in this list because they
+	//would not be freed anyway
+	while (m_usage > budget && !m_entries.isEmpty())
+	{
+		const Entry entry = m_entries.takeFirst();
+		Tagaro::SpriteFetcher* fetcher = entry.key.first;
+		m_index.remove(entry.key);
+		m_usage -= entry.bytes;
+		QHash<Tagaro::SpriteFetcher*, QSet<int> >::iterator it = m_fetcherFrames.find(fetcher);
+		it->remove(entry.key.second);
+		if (it->isEmpty())
+		{
+			m_fetcherFrames.erase(it);
+		}
+		fetcher->evictPixmap(entry.key.second);
+		if (!affectedFetchers.contains(fetcher))
+		{
+			affectedFetchers << fetcher;
+		}
+	}
+	//garbage-collect fetchers which are not used anymore
+	foreach (Tagaro::SpriteFetcher* fetcher, affectedFetchers)
+	{
+		fetcher->releaseIfUnused();
+	}
+}
+}
+
+//END pixmap memory budget
 
 #include "sprite_p.moc"
@@ -83,11 +83,28 @@ class TAGARO_EXPORT Sprite
 		///@warning Call only from GUI thread!
 		///
 		///The pixmap will always be rendered synchronously, i.e. in the same
-		///thread.
+		///thread. Use requestPixmap() to avoid blocking the GUI thread.
 		///
 		///The format of @a processingInstruction is defined by the graphics
 		///source implementation. It may not contain "@" characters.
 		QPixmap pixmap(const QSize& size, int frame = -1, const QString& processingInstruction = QString()) const;
+		///Requests a rendered pixmap asynchronously. The parameters @a size,
+		///@a frame and @a processingInstruction have the same meaning as for
+		///pixmap(). When the pixmap is available, the given @a member of the
+		///@a receiver is invoked in the GUI thread with the pixmap as its
+		///argument:
+		///@code
+		///    sprite->requestPixmap(QSize(32, 32), -1, QString(), this, SLOT(setDragPixmap(QPixmap)));
+		///@endcode
+		///The pixmap is taken from the same caches and rendering threads as
+		///the pixmaps for Tagaro::SpriteClient instances. The slot is always
+		///invoked after this method has returned, even if the pixmap is
+		///available immediately. If the sprite cannot be rendered (e.g.
+		///because it is destroyed in the meantime, or @a size is empty), the
+		///slot receives an invalid pixmap. If the @a receiver is destroyed
+		///before the pixmap is available, the request is cancelled.
+		///@warning Call only from GUI thread!
+		void requestPixmap(const QSize& size, int frame, const QString& processingInstruction, QObject* receiver, const char* member) const;
 	private:
 		class Private;
 		Private* const d;
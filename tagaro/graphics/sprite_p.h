@@ -21,8 +21,14 @@
 
 #include "sprite.h"
 #include "spriteclient.h"
+#include "renderscheduler_p.h"
 
+#include <QtCore/QBasicTimer>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QHash>
+#include <QtCore/QLinkedList>
+#include <QtCore/QPair>
+#include <QtCore/QSet>
 
 namespace Tagaro {
 
@@ -33,50 +39,304 @@ class SpriteFetcher : public QObject
 {
 	Q_OBJECT
 	public:
-		SpriteFetcher(const QSize& size, const QString& processingInstruction, Tagaro::Sprite::Private* d) : d(d), m_size(size), m_processingInstruction(processingInstruction) {}
+		SpriteFetcher(const Tagaro::RenderJobKey& key) : m_source(key.m_source), m_element(key.m_element), m_size(key.m_size), m_processingInstruction(key.m_processingInstruction), m_generation(0) {}
+		virtual ~SpriteFetcher();
+		//the key in the Tagaro::SpriteFetcherPool (with the sprite's element
+		//instead of a frame element)
+		inline Tagaro::RenderJobKey key() const { const Tagaro::RenderJobKey key = { m_source, m_element, m_size, m_processingInstruction }; return key; }
+		int normalizeFrame(int frame) const;
+
+		//The generation is increased whenever previously requested images
+		//become obsolete (e.g. on theme changes). Results of rendering jobs
+		//which have been requested by an older generation are discarded.
+		inline int generation() const { return m_generation; }
 
 		void addClient(Tagaro::SpriteClient* client);
 		void removeClient(Tagaro::SpriteClient* client);
 		void updateClient(Tagaro::SpriteClient* client);
-		void updateAllClients();
+		//Called when the source is about to be deleted. The clients (if
+		//any) receive transparent pixmaps from now on.
+		void detachSource();
+		//called when the render priority of the given client changes
+		void updatePriority(Tagaro::SpriteClient* client);
+		//whether the given frame can be delivered without rendering
+		bool hasPixmap(int frame) const;
+
+		//interface to Tagaro::PixmapBudget
+		bool isFrameHeld(int frame) const;
+		void evictPixmap(int frame);
+		//Deletes this fetcher (later) if it has neither clients nor pixmaps.
+		void releaseIfUnused();
+		//Drops all cached pixmaps and images which are not held by clients,
+		//and deletes this fetcher (later) if it has no clients.
+		void releaseCache();
+
+		//Places an image from the rendering threads (and its hit test mask)
+		//in the image cache, and sends it to the clients showing this frame.
+		//The image is converted into a pixmap only when a visible client
+		//needs it.
+		void cacheImage(int frame, const QImage& image, const Tagaro::AlphaMask& mask);
+		//Sends null pixmaps or images to the clients showing this frame,
+		//because it could not be rendered. Nothing is cached, so the next
+		//request for this frame starts a new rendering job.
+		void renderingFailed(int frame);
+		//the threshold for the hit test masks of this fetcher's frames
+		int alphaThreshold() const;
+		//Converts the given frame into a pixmap if it is still needed, and
+		//sends it to the clients. Called by Tagaro::RenderJobTable for
+		//conversions which have been deferred.
+		void promoteImage(int frame);
 	public Q_SLOTS:
 		//If called with a null @a image, looks in the cache for the given
 		//pixmap, or renders it synchronously on the given source. This
 		//interface is used for synchronous pixmap fetching.
 		//
 		//If @a image is not null, this image is converted and placed in the
-		//pixmap cache (if necessary). This interface is used for images
-		//returned from rendering threads.
+		//pixmap cache (if necessary).
 		QPixmap cachePixmap(int frame, const QImage& image);
 	private:
+		//the most urgent render priority of all clients showing this frame
+		Tagaro::RenderScheduler::Priority framePriority(int frame) const;
 		void startJob(int frame);
+		//Requests the frames which follow @a to if the client has advanced
+		//sequentially from @a from (in either direction).
+		void prefetch(int from, int to);
+		void updateJobPriority(int frame);
+		void clearPixmapCache();
+		void moveClient(Tagaro::SpriteClient* client, int frame);
+		//Sends the cached pixmap or image for the given frame to the given
+		//client (if the client needs it now). Returns false if nothing is
+		//cached for this frame.
+		bool serveClient(Tagaro::SpriteClient* client, int frame);
+		//Moves the given frame from the image cache into the pixmap cache.
+		//The image stays in the image cache if clients want images.
+		QPixmap convertImage(int frame);
+		bool hasImageClients(int frame) const;
 
-		Tagaro::Sprite::Private* const d;
+		const Tagaro::GraphicsSource* m_source;
+		QString m_element;
 		QSize m_size;
 		QString m_processingInstruction;
 
+		int m_generation;
+
 		QHash<int, QPixmap> m_pixmapCache;
-		QList<Tagaro::SpriteClient*> m_clients; //FIXME: utterly broken
+		//frames which have not been converted into pixmaps yet, and images of
+		//converted frames for clients with ImageDelivery
+		QHash<int, QImage> m_imageCache;
+		//hit test masks for the frames in both caches
+		QHash<int, Tagaro::AlphaMask> m_maskCache;
+		//clients, sorted by the normalized frame which they show
+		QHash<int, QSet<Tagaro::SpriteClient*> > m_clients;
+};
+
+//Owns all SpriteFetchers. Sprites which are rendered from the same element of
+//the same source (e.g. because the theme maps multiple sprite keys to one
+//element) share their fetchers, so that each pixmap is rendered and cached
+//only once. Lives in the GUI thread.
+class SpriteFetcherPool
+{
+	public:
+		~SpriteFetcherPool();
+		static Tagaro::SpriteFetcherPool* instance();
+
+		//Returns the fetcher for the given key, or 0 if it does not exist.
+		Tagaro::SpriteFetcher* find(const Tagaro::RenderJobKey& key) const;
+		//Returns the fetcher for the given key, and creates it if necessary.
+		Tagaro::SpriteFetcher* fetcher(const Tagaro::RenderJobKey& key);
+		//called by fetchers which are about to be deleted
+		void remove(Tagaro::SpriteFetcher* fetcher);
+		//Detaches all fetchers from the given source, which is about to be
+		//deleted. New fetchers will be created for new sources at the same
+		//address.
+		void releaseSource(const Tagaro::GraphicsSource* source);
+		//Calls releaseCache() on all fetchers for the given elements (e.g.
+		//because the sprites for these elements have been deleted).
+		void releaseElements(const QSet<QPair<const Tagaro::GraphicsSource*, QString> >& elements);
+	private:
+		QHash<Tagaro::RenderJobKey, Tagaro::SpriteFetcher*> m_fetchers;
+		//fetchers whose source has been released, but which still have clients
+		QList<Tagaro::SpriteFetcher*> m_detachedFetchers;
+};
+
+//Serves one pixmap for Tagaro::Sprite::requestPixmap(), and deletes itself
+//afterwards.
+class PixmapRequest : public QObject, public Tagaro::SpriteClient
+{
+	Q_OBJECT
+	public:
+		PixmapRequest(Tagaro::Sprite* sprite, QObject* receiver, const char* member);
+		void start(const QSize& size, int frame, const QString& processingInstruction);
+	Q_SIGNALS:
+		void pixmapReady(const QPixmap& pixmap);
+	protected:
+		virtual void receivePixmap(const QPixmap& pixmap);
+	private:
+		bool m_finished;
+};
+
+//Limits the memory used by the pixmap caches of all SpriteFetchers in the
+//process. When the total size of the cached pixmaps exceeds the budget from
+//Tagaro::Settings::pixmapCacheSize(), the least recently used pixmaps which
+//are not held by any client are evicted. Lives in the GUI thread.
+class PixmapBudget
+{
+	public:
+		PixmapBudget() : m_usage(0) {}
+		static Tagaro::PixmapBudget* instance();
+
+		//Records a new pixmap or image (with the given size in bytes) in the
+		//cache of the given fetcher, and evicts other pixmaps if necessary.
+		void insert(Tagaro::SpriteFetcher* fetcher, int frame, qint64 bytes);
+		//Marks the given pixmap as most recently used.
+		void touch(Tagaro::SpriteFetcher* fetcher, int frame);
+		//Forgets about the given pixmap.
+		void remove(Tagaro::SpriteFetcher* fetcher, int frame);
+		//Forgets about all pixmaps of the given fetcher.
+		void removeAll(Tagaro::SpriteFetcher* fetcher);
+		//Called by fetchers when the first client starts showing a frame, or
+		//when the last client stops showing it (see
+		//SpriteFetcher::isFrameHeld()). Held pixmaps cannot be evicted, so
+		//they are kept out of the eviction order.
+		void setHeld(Tagaro::SpriteFetcher* fetcher, int frame, bool held);
+	private:
+		typedef QPair<Tagaro::SpriteFetcher*, int> EntryKey;
+		void evict();
+		//removes the entry from the eviction order or the held entries
+		void forget(const EntryKey& key);
+
+		struct Entry
+		{
+			EntryKey key;
+			qint64 bytes;
+		};
+		QLinkedList<Entry> m_entries; //least recently used first
+		QHash<EntryKey, QLinkedList<Entry>::iterator> m_index;
+		QHash<EntryKey, qint64> m_heldEntries; //not in m_entries
+		QHash<Tagaro::SpriteFetcher*, QSet<int> > m_fetcherFrames; //of all entries
+		qint64 m_usage;
+};
+
+//Keeps track of the rendering jobs which are in flight, and delivers their
+//results to all fetchers which have requested them. Lives in the GUI thread.
+class RenderJobTable : public QObject
+{
+	public:
+		RenderJobTable();
+		virtual ~RenderJobTable();
+		static Tagaro::RenderJobTable* instance();
+
+		//Deletes the given source as soon as no rendering job uses it anymore.
+		//Use this instead of deleting graphics sources directly.
+		static void releaseSource(Tagaro::GraphicsSource* source);
+
+		//Requests the given frame for the given fetcher. A rendering job is
+		//only started if no identical job is running already. If the
+		//fetcher has requested this frame already, only the priority of
+		//its request is updated. A job always has the most urgent priority
+		//of all requests waiting for it.
+		void request(const Tagaro::RenderJobKey& key, Tagaro::SpriteFetcher* fetcher, int frame, Tagaro::RenderScheduler::Priority priority);
+		//Like request(), but renders all frames which are not being
+		//rendered yet in a single job. The keys must only differ in their
+		//element, and the source should support batch rendering.
+		void requestBatch(const QList<Tagaro::RenderJobKey>& keys, Tagaro::SpriteFetcher* fetcher, const QList<int>& frames, Tagaro::RenderScheduler::Priority priority);
+		//Withdraws the requests of the given fetcher for the given frame (or
+		//for all frames if @a frame is AllFrames). Jobs which are not wanted
+		//by anyone anymore are removed from the RenderRuntime's queues, or
+		//cancelled if they have been started already.
+		void withdraw(Tagaro::SpriteFetcher* fetcher, int frame);
+		static const int AllFrames = -2;
+		//Converts the given frame of the given fetcher into a pixmap in a
+		//later iteration of the event loop, within the time budget from
+		//Tagaro::Settings::conversionTimeBudget(). Withdrawing all frames of
+		//the fetcher also cancels its conversions.
+		void schedulePromotion(Tagaro::SpriteFetcher* fetcher, int frame);
+	protected:
+		//receives results from the rendering threads
+		virtual void customEvent(QEvent* event);
+		//continues delivery if the time budget was exceeded
+		virtual void timerEvent(QTimerEvent* event);
+	private:
+		//Delivers finished jobs until Tagaro::Settings::deliveryTimeBudget()
+		//is exceeded, then does deferred conversions. The remaining work is
+		//done in the next iteration of the event loop, so that input and
+		//paint events are not blocked.
+		void deliverResults();
+		void deliverResult(Tagaro::RenderJob* job);
+		void addWaiter(Tagaro::RenderJob* job, int index, Tagaro::SpriteFetcher* fetcher, int frame, Tagaro::RenderScheduler::Priority priority);
+		//removes all keys of the given job from m_jobs and m_fetcherJobs
+		void removeJob(Tagaro::RenderJob* job);
+		void updatePriority(Tagaro::RenderJob* job);
+		//deletes a job which has been finished or cancelled
+		void dropJob(Tagaro::RenderJob* job);
+
+		QHash<Tagaro::RenderJobKey, Tagaro::RenderJob*> m_jobs;
+		//the jobs in m_jobs for which each fetcher is waiting (so that
+		//withdraw() need not look at all jobs)
+		QMultiHash<Tagaro::SpriteFetcher*, Tagaro::RenderJob*> m_fetcherJobs;
+		Tagaro::RenderCompletionQueue m_completionQueue;
+		QList<Tagaro::RenderJob*> m_finishedJobs; //not delivered yet
+		QList<QPair<Tagaro::SpriteFetcher*, int> > m_pendingPromotions;
+		int m_deliveryTimerId;
+		//number of unfinished jobs per source (including cancelled jobs
+		//which are still held by a worker)
+		QHash<const Tagaro::GraphicsSource*, int> m_sourceJobCounts;
+		QList<Tagaro::GraphicsSource*> m_releasedSources;
+};
+
+//Implemented by the Tagaro::ThemeProvider which has created a sprite. Sprites
+//without clients are not remapped immediately when the selected theme changes,
+//but only when they are used again, so that theme changes do not become slower
+//with every sprite ever requested.
+class SpriteRegistry
+{
+	public:
+		SpriteRegistry() : m_generation(0) {}
+		virtual ~SpriteRegistry() {}
+
+		//increased whenever the mapping of sprite keys to elements changes
+		inline int generation() const { return m_generation; }
+		//Maps the given sprite to an element of the selected theme.
+		virtual void mapSprite(Tagaro::Sprite* sprite) = 0;
+		//Called when the given sprite has got its first client, or has lost
+		//its last client.
+		virtual void setSpriteUsed(Tagaro::Sprite* sprite, bool used) = 0;
+	protected:
+		int m_generation;
 };
 
 struct Sprite::Private
 {
 	public:
 		void setSource(const Tagaro::GraphicsSource* source, const QString& element);
+		//Remaps this sprite if the theme has changed while it was not used.
+		void updateMapping();
+		//the key by which the sprite is known in its provider
+		inline QString providerKey() const { return m_key; }
 
 		void addClient(Tagaro::SpriteClient* client);
 		void removeClient(Tagaro::SpriteClient* client);
 		Tagaro::SpriteFetcher* fetcher(const QSize& size, const QString& processingInstruction);
+		//whether the given frame is cached for the given size (without
+		//creating a fetcher)
+		bool hasPixmap(const QSize& size, const QString& processingInstruction, int frame) const;
 	private:
+		Tagaro::RenderJobKey fetcherKey(const QSize& size, const QString& processingInstruction) const;
+
 		friend class Tagaro::DeclarativeThemeProvider;
 		friend class Tagaro::Sprite;
-		friend class Tagaro::SpriteFetcher;
-		Private();
+		friend class Tagaro::ThemeProvider;
+		Private(Tagaro::Sprite* q);
 
+		Tagaro::Sprite* q;
 		const Tagaro::GraphicsSource* m_source;
 		QString m_element;
-	
-		QHash<QPair<QSize, QString>, SpriteFetcher*> m_fetchers; //key: size, processing instruction
+		//the provider which has created this sprite, and the key by which the
+		//sprite is known there
+		Tagaro::SpriteRegistry* m_registry;
+		QString m_key;
+		int m_generation; //of the registry at the time of the last mapping
+
 		QList<Tagaro::SpriteClient*> m_clients;
 };
 
@@ -86,15 +346,55 @@ struct SpriteClient::Private
 		Private(Tagaro::Sprite* sprite, Tagaro::SpriteClient* q);
 		void setFetcher(Tagaro::SpriteFetcher* fetcher);
 		void receivePixmap(const QPixmap& pixmap);
+		void receiveImage(const QImage& image);
+
+		//Shows the last pixmap scaled to the new render size, and requests
+		//the real pixmap after the resize quiet period.
+		void beginResize();
+		//called by Tagaro::ResizeDebouncer when the quiet period is over
+		void finishResize();
+		void cancelResize();
+		int resizeQuietPeriod() const;
 	private:
 		friend class Tagaro::SpriteClient;
+		friend class Tagaro::SpriteFetcher;
 		Tagaro::SpriteClient* q;
 		Tagaro::Sprite* m_sprite;
 		QSize m_size;
 		QString m_processingInstruction;
 		Tagaro::SpriteFetcher* m_fetcher;
 		int m_frame;
+		int m_fetcherFrame; //normalized frame, as known to m_fetcher
+		Tagaro::RenderScheduler::Priority m_priority;
+		qreal m_animationSpeed;
 		QPixmap m_pixmap;
+		//hit test mask for m_pixmap (or for m_resizeSource while m_resizing)
+		Tagaro::AlphaMask m_alphaMask;
+		int m_resizeQuietPeriod; //negative: use Tagaro::Settings
+		bool m_resizing;
+		QPixmap m_resizeSource; //the last real pixmap while m_resizing
+		Tagaro::SpriteClient::DeliveryMode m_deliveryMode;
+		QImage m_image;
+};
+
+//Delays the fetcher changes of resized clients until their size has been
+//stable for their quiet period. Lives in the GUI thread.
+class ResizeDebouncer : public QObject
+{
+	public:
+		ResizeDebouncer() { m_clock.start(); }
+
+		//(Re)starts the quiet period for the given client.
+		void schedule(Tagaro::SpriteClient* client, int quietPeriod);
+		void cancel(Tagaro::SpriteClient* client);
+	protected:
+		virtual void timerEvent(QTimerEvent* event);
+	private:
+		void restartTimer();
+
+		QHash<Tagaro::SpriteClient*, qint64> m_deadlines;
+		QBasicTimer m_timer;
+		QElapsedTimer m_clock;
 };
 
 } //namespace Tagaro
@@ -17,10 +17,17 @@
  ***************************************************************************/
 
 #include "spriteclient.h"
+#include "animationclock_p.h"
+#include "renderrecorder_p.h"
 #include "sprite.h"
 #include "sprite_p.h"
+#include "settings.h"
 
-#include <QtCore/QTimer>
+#include <QtCore/QTimerEvent>
+#include <QtGui/QTransform>
+#include <KDE/KGlobal>
+
+K_GLOBAL_STATIC(Tagaro::ResizeDebouncer, g_resizeDebouncer)
 
 //WARNING: d->m_sprite == 0 is allowed, and used actively by Tagaro::Scene.
 
@@ -29,12 +36,22 @@ Tagaro::SpriteClient::Private::Private(Tagaro::Sprite* sprite, Tagaro::SpriteCli
 	, m_sprite(sprite)
 	, m_fetcher(0)
 	, m_frame(-1)
+	, m_fetcherFrame(-1)
+	, m_priority(Tagaro::RenderScheduler::VisiblePriority)
+	, m_animationSpeed(0)
+	, m_resizeQuietPeriod(-1)
+	, m_resizing(false)
+	, m_deliveryMode(Tagaro::SpriteClient::PixmapDelivery)
 {
 }
 
 Tagaro::SpriteClient::SpriteClient(Tagaro::Sprite* sprite)
 	: d(new Private(sprite, this))
 {
+	if (Tagaro::RenderRecorder* recorder = Tagaro::RenderRecorder::instance())
+	{
+		recorder->record("create", this, Tagaro::RenderRecorder::encode(sprite ? sprite->d->providerKey() : QString()));
+	}
 	if (sprite)
 	{
 		sprite->d->addClient(this);
@@ -45,6 +62,19 @@ Tagaro::SpriteClient::~SpriteClient()
 {
 	//This is setSprite(0), but that can't be called directly because this might
 	//call receivePixmap() which is pure virtual at this point.
+	if (Tagaro::RenderRecorder* recorder = Tagaro::RenderRecorder::instance())
+	{
+		recorder->removeClient(this);
+	}
+	Tagaro::AnimationTimer* timer = Tagaro::AnimationTimer::instance();
+	if (d->m_animationSpeed != 0 && timer)
+	{
+		timer->setSpeed(this, 0);
+	}
+	if (d->m_resizing && !g_resizeDebouncer.isDestroyed())
+	{
+		g_resizeDebouncer->cancel(this);
+	}
 	if (d->m_sprite)
 	{
 		if (d->m_fetcher)
@@ -65,6 +95,11 @@ void Tagaro::SpriteClient::setSprite(Tagaro::Sprite* sprite)
 {
 	if (d->m_sprite != sprite)
 	{
+		if (Tagaro::RenderRecorder* recorder = Tagaro::RenderRecorder::instance())
+		{
+			recorder->record("sprite", this, Tagaro::RenderRecorder::encode(sprite ? sprite->d->providerKey() : QString()));
+		}
+		d->cancelResize();
 		if (d->m_sprite)
 		{
 			if (d->m_fetcher)
@@ -100,7 +135,15 @@ void Tagaro::SpriteClient::setFrame(int frame)
 {
 	if (d->m_frame != frame)
 	{
+		if (Tagaro::RenderRecorder* recorder = Tagaro::RenderRecorder::instance())
+		{
+			recorder->record("frame", this, QByteArray::number(frame));
+		}
 		d->m_frame = frame;
+		if (d->m_animationSpeed != 0)
+		{
+			Tagaro::AnimationTimer::instance()->setFrame(this, frame);
+		}
 		if (d->m_fetcher)
 		{
 			d->m_fetcher->updateClient(this);
@@ -108,6 +151,20 @@ void Tagaro::SpriteClient::setFrame(int frame)
 	}
 }
 
+qreal Tagaro::SpriteClient::animationSpeed() const
+{
+	return d->m_animationSpeed;
+}
+
+void Tagaro::SpriteClient::setAnimationSpeed(qreal framesPerSecond)
+{
+	if (d->m_animationSpeed != framesPerSecond)
+	{
+		d->m_animationSpeed = framesPerSecond;
+		Tagaro::AnimationTimer::instance()->setSpeed(this, framesPerSecond);
+	}
+}
+
 QString Tagaro::SpriteClient::processingInstruction() const
 {
 	return d->m_processingInstruction;
@@ -117,6 +174,10 @@ void Tagaro::SpriteClient::setProcessingInstruction(const QString& processingIns
 {
 	if (d->m_processingInstruction != processingInstruction)
 	{
+		if (Tagaro::RenderRecorder* recorder = Tagaro::RenderRecorder::instance())
+		{
+			recorder->record("pi", this, Tagaro::RenderRecorder::encode(processingInstruction));
+		}
 		d->m_processingInstruction = processingInstruction;
 		Tagaro::SpriteFetcher* f = 0;
 		if (d->m_sprite)
@@ -136,7 +197,20 @@ void Tagaro::SpriteClient::setRenderSize(const QSize& size)
 {
 	if (d->m_size != size)
 	{
+		if (Tagaro::RenderRecorder* recorder = Tagaro::RenderRecorder::instance())
+		{
+			recorder->record("size", this, QByteArray::number(size.width()) + ' ' + QByteArray::number(size.height()));
+		}
 		d->m_size = size;
+		//show a scaled version of the last pixmap if the new size has not
+		//been rendered yet
+		if (d->m_sprite && !size.isEmpty() && d->resizeQuietPeriod() > 0
+			&& (d->m_resizing || !d->m_pixmap.isNull())
+			&& !d->m_sprite->d->hasPixmap(size, d->m_processingInstruction, d->m_frame))
+		{
+			d->beginResize();
+			return;
+		}
 		Tagaro::SpriteFetcher* f = 0;
 		if (d->m_sprite)
 		{
@@ -146,8 +220,90 @@ void Tagaro::SpriteClient::setRenderSize(const QSize& size)
 	}
 }
 
+int Tagaro::SpriteClient::resizeQuietPeriod() const
+{
+	return d->resizeQuietPeriod();
+}
+
+void Tagaro::SpriteClient::setResizeQuietPeriod(int quietPeriod)
+{
+	d->m_resizeQuietPeriod = qMax(0, quietPeriod);
+}
+
+int Tagaro::SpriteClient::Private::resizeQuietPeriod() const
+{
+	return m_resizeQuietPeriod >= 0 ? m_resizeQuietPeriod : Tagaro::Settings::resizeQuietPeriod();
+}
+
+void Tagaro::SpriteClient::Private::beginResize()
+{
+	if (!m_resizing)
+	{
+		//the old fetcher's pixmaps have the wrong size from now on
+		if (m_fetcher)
+		{
+			m_fetcher->removeClient(q);
+			m_fetcher = 0;
+		}
+		m_resizing = true;
+		m_resizeSource = m_pixmap;
+	}
+	g_resizeDebouncer->schedule(q, resizeQuietPeriod());
+	//always scale the last real pixmap to avoid accumulating scaling artifacts
+	receivePixmap(m_resizeSource.scaled(m_size, Qt::IgnoreAspectRatio, Qt::FastTransformation));
+}
+
+void Tagaro::SpriteClient::Private::cancelResize()
+{
+	if (m_resizing)
+	{
+		g_resizeDebouncer->cancel(q);
+		m_resizing = false;
+		m_resizeSource = QPixmap();
+	}
+}
+
+void Tagaro::SpriteClient::Private::finishResize()
+{
+	m_resizing = false;
+	m_resizeSource = QPixmap();
+	Tagaro::SpriteFetcher* f = 0;
+	if (m_sprite)
+	{
+		f = m_sprite->d->fetcher(m_size, m_processingInstruction);
+	}
+	setFetcher(f);
+}
+
+Tagaro::RenderScheduler::Priority Tagaro::SpriteClient::renderPriority() const
+{
+	return d->m_priority;
+}
+
+void Tagaro::SpriteClient::setRenderPriority(Tagaro::RenderScheduler::Priority priority)
+{
+	if (d->m_priority != priority)
+	{
+		if (Tagaro::RenderRecorder* recorder = Tagaro::RenderRecorder::instance())
+		{
+			recorder->record("priority", this, QByteArray::number(int(priority)));
+		}
+		d->m_priority = priority;
+		if (d->m_animationSpeed != 0)
+		{
+			Tagaro::AnimationTimer::instance()->setActive(this, priority != Tagaro::RenderScheduler::WarmupPriority);
+		}
+		if (d->m_fetcher)
+		{
+			d->m_fetcher->updatePriority(this);
+		}
+	}
+}
+
 void Tagaro::SpriteClient::Private::setFetcher(Tagaro::SpriteFetcher* fetcher)
 {
+	//the new fetcher is requested right now
+	cancelResize();
 	if (m_fetcher == fetcher)
 	{
 		return;
@@ -172,8 +328,160 @@ QPixmap Tagaro::SpriteClient::pixmap() const
 	return d->m_pixmap;
 }
 
+QImage Tagaro::SpriteClient::image() const
+{
+	return d->m_image;
+}
+
+bool Tagaro::SpriteClient::isOpaqueAt(const QPointF& point) const
+{
+	const QSize size = d->m_deliveryMode == ImageDelivery ? d->m_image.size() : d->m_pixmap.size();
+	if (size.isEmpty() || point.x() < 0 || point.y() < 0 || point.x() >= size.width() || point.y() >= size.height())
+	{
+		return false;
+	}
+	//While resizing, the pixmap is scaled from a pixmap in another size, and
+	//the mask belongs to that pixmap.
+	const Tagaro::AlphaMask& mask = d->m_alphaMask;
+	const QSize maskSize = mask.size();
+	return mask.testPixel(
+		int(point.x() * maskSize.width() / size.width()),
+		int(point.y() * maskSize.height() / size.height())
+	);
+}
+
+QPainterPath Tagaro::SpriteClient::opaqueShape() const
+{
+	const QSize size = d->m_deliveryMode == ImageDelivery ? d->m_image.size() : d->m_pixmap.size();
+	QPainterPath shape;
+	if (size.isEmpty())
+	{
+		return shape;
+	}
+	const Tagaro::AlphaMask& mask = d->m_alphaMask;
+	if (mask.isNull())
+	{
+		shape.addRect(QRectF(QPointF(), size));
+		return shape;
+	}
+	shape = mask.shape();
+	//see isOpaqueAt()
+	const QSize maskSize = mask.size();
+	if (maskSize != size)
+	{
+		shape = QTransform::fromScale(
+			qreal(size.width()) / maskSize.width(),
+			qreal(size.height()) / maskSize.height()
+		).map(shape);
+	}
+	return shape;
+}
+
+Tagaro::SpriteClient::DeliveryMode Tagaro::SpriteClient::deliveryMode() const
+{
+	return d->m_deliveryMode;
+}
+
+void Tagaro::SpriteClient::setDeliveryMode(Tagaro::SpriteClient::DeliveryMode mode)
+{
+	if (d->m_deliveryMode != mode)
+	{
+		if (Tagaro::RenderRecorder* recorder = Tagaro::RenderRecorder::instance())
+		{
+			recorder->record("delivery", this, QByteArray::number(int(mode)));
+		}
+		d->m_deliveryMode = mode;
+		if (mode == Tagaro::SpriteClient::PixmapDelivery)
+		{
+			d->m_image = QImage();
+		}
+		//deliver the current frame again in the new form
+		if (d->m_fetcher)
+		{
+			d->m_fetcher->updateClient(this);
+		}
+	}
+}
+
+void Tagaro::SpriteClient::receiveImage(const QImage& image)
+{
+	Q_UNUSED(image)
+}
+
 void Tagaro::SpriteClient::Private::receivePixmap(const QPixmap& pixmap)
 {
 	m_pixmap = pixmap;
 	q->receivePixmap(pixmap);
 }
+
+void Tagaro::SpriteClient::Private::receiveImage(const QImage& image)
+{
+	m_image = image;
+	q->receiveImage(image);
+}
+
+//BEGIN Tagaro::ResizeDebouncer
+
+void Tagaro::ResizeDebouncer::schedule(Tagaro::SpriteClient* client, int quietPeriod)
+{
+	m_deadlines.insert(client, m_clock.elapsed() + quietPeriod);
+	restartTimer();
+}
+
+void Tagaro::ResizeDebouncer::cancel(Tagaro::SpriteClient* client)
+{
+	if (m_deadlines.remove(client))
+	{
+		restartTimer();
+	}
+}
+
+void Tagaro::ResizeDebouncer::restartTimer()
+{
+	if (m_deadlines.isEmpty())
+	{
+		m_timer.stop();
+		return;
+	}
+	qint64 deadline = -1;
+	foreach (qint64 clientDeadline, m_deadlines)
+	{
+		if (deadline < 0 || clientDeadline < deadline)
+		{
+			deadline = clientDeadline;
+		}
+	}
+	m_timer.start(qMax(qint64(0), deadline - m_clock.elapsed()), this);
+}
+
+void Tagaro::ResizeDebouncer::timerEvent(QTimerEvent* event)
+{
+	if (event->timerId() != m_timer.timerId())
+	{
+		QObject::timerEvent(event);
+		return;
+	}
+	//collect the clients first because finishResize() modifies m_deadlines
+	const qint64 now = m_clock.elapsed();
+	QList<Tagaro::SpriteClient*> clients;
+	QHash<Tagaro::SpriteClient*, qint64>::iterator it = m_deadlines.begin();
+	while (it != m_deadlines.end())
+	{
+		if (it.value() <= now)
+		{
+			clients << it.key();
+			it = m_deadlines.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+	foreach (Tagaro::SpriteClient* client, clients)
+	{
+		client->d->finishResize();
+	}
+	restartTimer();
+}
+
+//END Tagaro::ResizeDebouncer
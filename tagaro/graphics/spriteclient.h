@@ -19,12 +19,17 @@
 #ifndef TAGARO_SPRITECLIENT_H
 #define TAGARO_SPRITECLIENT_H
 
+#include <QtCore/QPointF>
+#include <QtGui/QImage>
+#include <QtGui/QPainterPath>
 #include <QtGui/QPixmap>
 
+#include "renderscheduler.h"
 #include <libtagaro_export.h>
 
 namespace Tagaro {
 
+class ResizeDebouncer;
 class Sprite;
 class SpriteFetcher;
 
@@ -42,6 +47,20 @@ class SpriteFetcher;
 class TAGARO_EXPORT SpriteClient
 {
 	public:
+		///How rendered frames are delivered to the client.
+		enum DeliveryMode
+		{
+			///The client receives QPixmaps via receivePixmap(). Pixmaps are
+			///only created when the client is visible (according to its
+			///renderPriority()), or shortly before.
+			PixmapDelivery = 0,
+			///The client receives QImages via receiveImage(), and
+			///receivePixmap() is not called for rendered frames. This avoids
+			///the conversion into QPixmap, which is useful e.g. for clients
+			///which paint with the raster paint engine anyway.
+			ImageDelivery
+		};
+
 		///Creates a new client which receives pixmaps for the given @a sprite.
 		///You may give a null pointer to @a sprite to disable pixmap fetching.
 		///The pixmap() will then be invalid.
@@ -67,6 +86,20 @@ class TAGARO_EXPORT SpriteClient
 		///    client.setFrame(KRandom::random());  //choose a random frame
 		///@endcode
 		void setFrame(int frame);
+		///@return the animation speed (in frames per second)
+		///@see setAnimationSpeed
+		qreal animationSpeed() const;
+		///For animated sprites, cycle through the frames automatically with
+		///the given speed (in frames per second). Negative speeds play the
+		///animation backwards. The default speed is 0, i.e. the frame only
+		///changes when setFrame() is called.
+		///
+		///All animations are driven by one central Tagaro::AnimationClock
+		///instead of one timer per client. The animation continues from the
+		///current frame, and from the new frame when setFrame() is called
+		///while the animation is running. It is suspended while the client
+		///is not shown anywhere (see setRenderPriority()).
+		void setAnimationSpeed(qreal framesPerSecond);
 
 		///@return additional information for the graphics source
 		QString processingInstruction() const;
@@ -84,15 +117,74 @@ class TAGARO_EXPORT SpriteClient
 		///
 		///The default render size is empty, so that pixmap rendering is
 		///disabled (i.e. pixmap() is invalid).
+		///
+		///If no pixmap is available for the new size yet, the client shows
+		///its previous pixmap, scaled to the new size, until the render size
+		///has not changed for resizeQuietPeriod(). Only then is the pixmap
+		///for the new size requested, so that e.g. a resize drag does not
+		///start a rendering job for every intermediate size.
 		void setRenderSize(const QSize& renderSize);
+		///@return the resize quiet period (in milliseconds)
+		///@see setResizeQuietPeriod
+		int resizeQuietPeriod() const;
+		///Sets the time for which the render size must be stable before a
+		///pixmap in the new size is requested (see setRenderSize()). If this
+		///is not positive, the pixmap is requested immediately. The default
+		///is taken from Tagaro::Settings::resizeQuietPeriod().
+		void setResizeQuietPeriod(int quietPeriod);
 		///@return the rendered pixmap (or an invalid pixmap if no pixmap has
 		///been rendered yet)
 		QPixmap pixmap() const;
+		///@return the rendered image (or a null image if no image has been
+		///rendered yet, or if the deliveryMode() is PixmapDelivery)
+		QImage image() const;
+		///@return whether the given @a point (in the coordinates of the
+		///current pixmap() or image()) hits an opaque pixel
+		///
+		///This hit test is cheap: It uses a 1-bit mask which is built for
+		///each frame when it is rendered, and shared between all clients
+		///showing this frame. The threshold for opaque pixels is
+		///Tagaro::GraphicsSourceConfig::alphaThreshold().
+		bool isOpaqueAt(const QPointF& point) const;
+		///@return the outline of the opaque pixels of the current pixmap()
+		///or image() (in their coordinates), or an empty path if nothing has
+		///been rendered yet
+		///
+		///Like the mask for isOpaqueAt(), this outline is traced when the
+		///frame is rendered, and shared between all clients showing this
+		///frame, so that collision detection does not need to rasterize
+		///anything. It is simplified, and may thus deviate from the exact
+		///pixel outline by about one pixel.
+		QPainterPath opaqueShape() const;
+
+		///@return how rendered frames are delivered to this client
+		Tagaro::SpriteClient::DeliveryMode deliveryMode() const;
+		///Sets how rendered frames are delivered to this client. The default
+		///is PixmapDelivery.
+		void setDeliveryMode(Tagaro::SpriteClient::DeliveryMode mode);
+
+		///@return how urgently this client needs its pixmap
+		Tagaro::RenderScheduler::Priority renderPriority() const;
+		///Tells the rendering threads how urgently this client needs its
+		///pixmap. Pending rendering jobs for this client are moved into the
+		///new priority class. The default is
+		///Tagaro::RenderScheduler::VisiblePriority.
+		///
+		///Tagaro::SpriteObjectItem derives this hint automatically from its
+		///visibility. Animations of clients with
+		///Tagaro::RenderScheduler::WarmupPriority are suspended.
+		void setRenderPriority(Tagaro::RenderScheduler::Priority priority);
 	protected:
 		///This method is called when a new pixmap has been rendered for this
 		///client (esp. after theme changes and calls to the client's setters).
 		virtual void receivePixmap(const QPixmap& pixmap) = 0;
+		///This method is called instead of receivePixmap() when a new image
+		///has been rendered for this client, if the deliveryMode() is
+		///ImageDelivery. The default implementation does nothing.
+		virtual void receiveImage(const QImage& image);
 	private:
+		friend class Tagaro::ResizeDebouncer;
+		friend class Tagaro::Sprite;
 		friend class Tagaro::SpriteFetcher;
 		class Private;
 		Private* const d;
@@ -0,0 +1,536 @@
+/***************************************************************************
+ *   Copyright 2011 Stefan Majewsky <majewsky@gmx.net>                     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "spritelayeritem.h"
+#include "spritelayeritem_p.h"
+#include "spriteobjectitem_p.h"
+#include "../interface/board_p.h"
+
+#include <QtCore/qmath.h>
+#include <QtGui/QPainter>
+#include <QtGui/QStyleOptionGraphicsItem>
+
+Tagaro::SpriteLayerClient::SpriteLayerClient(Tagaro::SpriteLayerItem* layer, Tagaro::Sprite* sprite, int frame)
+	: Tagaro::SpriteClient(sprite)
+	, m_layer(layer)
+{
+	setFrame(frame);
+}
+
+void Tagaro::SpriteLayerClient::receivePixmap(const QPixmap& pixmap)
+{
+	Q_UNUSED(pixmap)
+	foreach (int index, m_instances)
+	{
+		const Tagaro::SpriteLayerItem::Private::Instance* instance = m_layer->d->instance(index);
+		if (instance && instance->visible)
+		{
+			m_layer->update(m_layer->d->instanceRect(*instance));
+		}
+	}
+}
+
+Tagaro::SpriteLayerItem::Private::Private(Tagaro::SpriteLayerItem* q)
+	: m_board(0)
+	, q(q)
+	, m_instanceSize(1, 1)
+	, m_priority(Tagaro::RenderScheduler::VisiblePriority)
+{
+}
+
+Tagaro::SpriteLayerItem::Private::~Private()
+{
+	qDeleteAll(m_clients);
+}
+
+Tagaro::SpriteLayerItem::SpriteLayerItem(QGraphicsItem* parent)
+	: QGraphicsObject(parent)
+	, d(new Private(this))
+{
+	//paint() needs the exposed rect, and itemChange() needs to know about
+	//movements to update the render priority
+	setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+	setFlag(QGraphicsItem::ItemSendsGeometryChanges);
+	d->findBoardFromParent(parent);
+	d->updateRenderPriority();
+}
+
+Tagaro::SpriteLayerItem::~SpriteLayerItem()
+{
+	//deregister from board, if any
+	d->findBoardFromParent(0);
+	//usual cleanup
+	delete d;
+}
+
+void Tagaro::SpriteLayerItem::Private::findBoardFromParent(QGraphicsItem* parent)
+{
+	//find board among parents (see Tagaro::SpriteObjectItem)
+	Tagaro::Board* board = 0;
+	while (parent)
+	{
+		QGraphicsObject* obj = parent->toGraphicsObject();
+		if (obj && (board = qobject_cast<Tagaro::Board*>(obj)))
+		{
+			break;
+		}
+		parent = parent->parentItem();
+	}
+	if (m_board)
+	{
+		m_board->d->unregisterLayer(q);
+	}
+	m_board = board;
+	if (board)
+	{
+		board->d->registerLayer(q);
+	}
+}
+
+QVariant Tagaro::SpriteLayerItem::itemChange(QGraphicsItem::GraphicsItemChange change, const QVariant& value)
+{
+	switch (change)
+	{
+		case QGraphicsItem::ItemParentChange:
+			d->findBoardFromParent(value.value<QGraphicsItem*>());
+			break;
+		case QGraphicsItem::ItemSceneHasChanged:
+		case QGraphicsItem::ItemVisibleHasChanged:
+		case QGraphicsItem::ItemPositionHasChanged:
+		case QGraphicsItem::ItemTransformHasChanged:
+			d->updateRenderPriority();
+			break;
+		default:
+			break;
+	}
+	return QGraphicsObject::itemChange(change, value);
+}
+
+void Tagaro::SpriteLayerItem::Private::updateRenderPriority()
+{
+	//same rules as in Tagaro::SpriteObjectItem, but for the whole layer
+	const Tagaro::RenderScheduler::Priority priority = Tagaro::SpriteObjectItem::Private::renderPriority(q);
+	if (m_priority != priority)
+	{
+		m_priority = priority;
+		foreach (Tagaro::SpriteLayerClient* client, m_clients)
+		{
+			client->setRenderPriority(priority);
+		}
+	}
+}
+
+//BEGIN instance management
+
+QSizeF Tagaro::SpriteLayerItem::instanceSize() const
+{
+	return d->m_instanceSize;
+}
+
+void Tagaro::SpriteLayerItem::setInstanceSize(const QSizeF& size)
+{
+	if (d->m_instanceSize != size && size.isValid() && !size.isEmpty())
+	{
+		prepareGeometryChange();
+		d->m_instanceSize = size;
+		d->rebuildIndex();
+		d->updateRenderPriority();
+		emit instanceSizeChanged(size);
+		update();
+	}
+}
+
+QSize Tagaro::SpriteLayerItem::renderSize() const
+{
+	return d->m_renderSize;
+}
+
+void Tagaro::SpriteLayerItem::setRenderSize(const QSize& size)
+{
+	if (d->m_renderSize != size)
+	{
+		d->m_renderSize = size;
+		foreach (Tagaro::SpriteLayerClient* client, d->m_clients)
+		{
+			client->setRenderSize(size);
+		}
+	}
+}
+
+Tagaro::SpriteLayerClient* Tagaro::SpriteLayerItem::Private::acquireClient(Tagaro::Sprite* sprite, int frame, int index)
+{
+	Tagaro::SpriteLayerClient*& client = m_clients[qMakePair(sprite, frame)];
+	if (!client)
+	{
+		client = new Tagaro::SpriteLayerClient(q, sprite, frame);
+		client->setRenderPriority(m_priority);
+		client->setRenderSize(m_renderSize);
+	}
+	client->m_instances.insert(index);
+	return client;
+}
+
+void Tagaro::SpriteLayerItem::Private::releaseClient(Tagaro::SpriteLayerClient* client, int index)
+{
+	client->m_instances.remove(index);
+	if (client->m_instances.isEmpty())
+	{
+		m_clients.remove(qMakePair(client->sprite(), client->frame()));
+		delete client;
+	}
+}
+
+Tagaro::SpriteLayerItem::Private::Instance* Tagaro::SpriteLayerItem::Private::instance(int index)
+{
+	if (index < 0 || index >= m_instances.count() || !m_instances[index].client)
+	{
+		return 0;
+	}
+	return &m_instances[index];
+}
+
+const Tagaro::SpriteLayerItem::Private::Instance* Tagaro::SpriteLayerItem::Private::instance(int index) const
+{
+	if (index < 0 || index >= m_instances.count() || !m_instances[index].client)
+	{
+		return 0;
+	}
+	return &m_instances[index];
+}
+
+void Tagaro::SpriteLayerItem::Private::includeRect(const QRectF& rect)
+{
+	if (!m_boundingRect.contains(rect))
+	{
+		q->prepareGeometryChange();
+		m_boundingRect = m_boundingRect.isNull() ? rect : m_boundingRect.united(rect);
+	}
+}
+
+int Tagaro::SpriteLayerItem::addInstance(Tagaro::Sprite* sprite, const QPointF& position, int frame)
+{
+	const int index = d->m_freeIndices.isEmpty() ? d->m_instances.count() : d->m_freeIndices.takeLast();
+	const Tagaro::SpriteLayerItem::Private::Instance instance = { d->acquireClient(sprite, frame, index), position, true };
+	if (index == d->m_instances.count())
+	{
+		d->m_instances << instance;
+	}
+	else
+	{
+		d->m_instances[index] = instance;
+	}
+	d->indexInstance(index);
+	const QRectF rect = d->instanceRect(instance);
+	d->includeRect(rect);
+	update(rect);
+	return index;
+}
+
+void Tagaro::SpriteLayerItem::removeInstance(int index)
+{
+	Tagaro::SpriteLayerItem::Private::Instance* instance = d->instance(index);
+	if (!instance)
+	{
+		return;
+	}
+	update(d->instanceRect(*instance));
+	d->unindexInstance(index);
+	d->releaseClient(instance->client, index);
+	instance->client = 0;
+	d->m_freeIndices << index;
+}
+
+void Tagaro::SpriteLayerItem::clearInstances()
+{
+	prepareGeometryChange();
+	qDeleteAll(d->m_clients);
+	d->m_clients.clear();
+	d->m_instances.clear();
+	d->m_freeIndices.clear();
+	d->m_index.clear();
+	d->m_boundingRect = QRectF();
+}
+
+int Tagaro::SpriteLayerItem::instanceCount() const
+{
+	return d->m_instances.count();
+}
+
+Tagaro::Sprite* Tagaro::SpriteLayerItem::instanceSprite(int index) const
+{
+	const Tagaro::SpriteLayerItem::Private::Instance* instance = d->instance(index);
+	return instance ? instance->client->sprite() : 0;
+}
+
+void Tagaro::SpriteLayerItem::setInstanceSprite(int index, Tagaro::Sprite* sprite)
+{
+	Tagaro::SpriteLayerItem::Private::Instance* instance = d->instance(index);
+	if (instance && instance->client->sprite() != sprite)
+	{
+		Tagaro::SpriteLayerClient* oldClient = instance->client;
+		instance->client = d->acquireClient(sprite, oldClient->frame(), index);
+		d->releaseClient(oldClient, index);
+		update(d->instanceRect(*instance));
+	}
+}
+
+int Tagaro::SpriteLayerItem::instanceFrame(int index) const
+{
+	const Tagaro::SpriteLayerItem::Private::Instance* instance = d->instance(index);
+	return instance ? instance->client->frame() : -1;
+}
+
+void Tagaro::SpriteLayerItem::setInstanceFrame(int index, int frame)
+{
+	Tagaro::SpriteLayerItem::Private::Instance* instance = d->instance(index);
+	if (instance && instance->client->frame() != frame)
+	{
+		Tagaro::SpriteLayerClient* oldClient = instance->client;
+		instance->client = d->acquireClient(oldClient->sprite(), frame, index);
+		d->releaseClient(oldClient, index);
+		update(d->instanceRect(*instance));
+	}
+}
+
+QPointF Tagaro::SpriteLayerItem::instancePosition(int index) const
+{
+	const Tagaro::SpriteLayerItem::Private::Instance* instance = d->instance(index);
+	return instance ? instance->position : QPointF();
+}
+
+void Tagaro::SpriteLayerItem::setInstancePosition(int index, const QPointF& position)
+{
+	Tagaro::SpriteLayerItem::Private::Instance* instance = d->instance(index);
+	if (instance && instance->position != position)
+	{
+		update(d->instanceRect(*instance));
+		d->unindexInstance(index);
+		instance->position = position;
+		d->indexInstance(index);
+		const QRectF rect = d->instanceRect(*instance);
+		d->includeRect(rect);
+		update(rect);
+	}
+}
+
+bool Tagaro::SpriteLayerItem::isInstanceVisible(int index) const
+{
+	const Tagaro::SpriteLayerItem::Private::Instance* instance = d->instance(index);
+	return instance && instance->visible;
+}
+
+void Tagaro::SpriteLayerItem::setInstanceVisible(int index, bool visible)
+{
+	Tagaro::SpriteLayerItem::Private::Instance* instance = d->instance(index);
+	if (instance && instance->visible != visible)
+	{
+		instance->visible = visible;
+		update(d->instanceRect(*instance));
+	}
+}
+
+//END instance management
+//BEGIN spatial index
+
+Tagaro::SpriteLayerItem::Private::Cell Tagaro::SpriteLayerItem::Private::cellAt(const QPointF& point) const
+{
+	return Cell(qFloor(point.x() / m_instanceSize.width()), qFloor(point.y() / m_instanceSize.height()));
+}
+
+void Tagaro::SpriteLayerItem::Private::indexInstance(int index)
+{
+	const QRectF rect = instanceRect(m_instances[index]);
+	const Cell first = cellAt(rect.topLeft());
+	//the bottom and right edges do not belong to the instance
+	const int lastX = qCeil(rect.right() / m_instanceSize.width()) - 1;
+	const int lastY = qCeil(rect.bottom() / m_instanceSize.height()) - 1;
+	for (int x = first.first; x <= lastX; ++x)
+	{
+		for (int y = first.second; y <= lastY; ++y)
+		{
+			m_index[Cell(x, y)] << index;
+		}
+	}
+}
+
+void Tagaro::SpriteLayerItem::Private::unindexInstance(int index)
+{
+	const QRectF rect = instanceRect(m_instances[index]);
+	const Cell first = cellAt(rect.topLeft());
+	const int lastX = qCeil(rect.right() / m_instanceSize.width()) - 1;
+	const int lastY = qCeil(rect.bottom() / m_instanceSize.height()) - 1;
+	for (int x = first.first; x <= lastX; ++x)
+	{
+		for (int y = first.second; y <= lastY; ++y)
+		{
+			QHash<Cell, QVector<int> >::iterator it = m_index.find(Cell(x, y));
+			if (it == m_index.end())
+			{
+				continue;
+			}
+			const int position = it->indexOf(index);
+			if (position >= 0)
+			{
+				it->remove(position);
+			}
+			if (it->isEmpty())
+			{
+				m_index.erase(it);
+			}
+		}
+	}
+}
+
+void Tagaro::SpriteLayerItem::Private::rebuildIndex()
+{
+	m_index.clear();
+	m_boundingRect = QRectF();
+	for (int index = 0; index < m_instances.count(); ++index)
+	{
+		if (m_instances[index].client)
+		{
+			indexInstance(index);
+			const QRectF rect = instanceRect(m_instances[index]);
+			m_boundingRect = m_boundingRect.isNull() ? rect : m_boundingRect.united(rect);
+		}
+	}
+}
+
+QList<int> Tagaro::SpriteLayerItem::instancesIn(const QRectF& rect) const
+{
+	QVector<int> candidates;
+	//cells outside the bounding rect are empty
+	const QRectF searchRect = rect.intersected(d->m_boundingRect);
+	if (searchRect.isEmpty())
+	{
+		return QList<int>();
+	}
+	const Tagaro::SpriteLayerItem::Private::Cell first = d->cellAt(searchRect.topLeft());
+	const Tagaro::SpriteLayerItem::Private::Cell last = d->cellAt(searchRect.bottomRight());
+	for (int x = first.first; x <= last.first; ++x)
+	{
+		for (int y = first.second; y <= last.second; ++y)
+		{
+			candidates += d->m_index.value(Tagaro::SpriteLayerItem::Private::Cell(x, y));
+		}
+	}
+	//instances which span multiple cells are found multiple times
+	qSort(candidates);
+	QList<int> result;
+	int previous = -1;
+	foreach (int index, candidates)
+	{
+		if (index == previous)
+		{
+			continue;
+		}
+		previous = index;
+		const Tagaro::SpriteLayerItem::Private::Instance& instance = d->m_instances[index];
+		if (instance.visible && d->instanceRect(instance).intersects(rect))
+		{
+			result << index;
+		}
+	}
+	return result;
+}
+
+int Tagaro::SpriteLayerItem::instanceAt(const QPointF& point) const
+{
+	const QVector<int> candidates = d->m_index.value(d->cellAt(point));
+	//the instance with the highest index is painted on top; the candidates
+	//are not sorted because removed indices are reused
+	int result = -1;
+	foreach (int index, candidates)
+	{
+		if (index < result)
+		{
+			continue;
+		}
+		const Tagaro::SpriteLayerItem::Private::Instance& instance = d->m_instances[index];
+		const QRectF rect = d->instanceRect(instance);
+		if (!instance.visible || !rect.contains(point))
+		{
+			continue;
+		}
+		//map the point into the coordinates of the (scaled) pixmap
+		const QSize pixmapSize = instance.client->pixmap().size();
+		const QPointF pixmapPoint(
+			(point.x() - rect.left()) * pixmapSize.width() / rect.width(),
+			(point.y() - rect.top()) * pixmapSize.height() / rect.height()
+		);
+		if (instance.client->isOpaqueAt(pixmapPoint))
+		{
+			result = index;
+		}
+	}
+	return result;
+}
+
+//END spatial index
+//BEGIN QGraphicsItem reimplementation
+
+QRectF Tagaro::SpriteLayerItem::boundingRect() const
+{
+	return d->m_boundingRect;
+}
+
+bool Tagaro::SpriteLayerItem::contains(const QPointF& point) const
+{
+	return instanceAt(point) >= 0;
+}
+
+void Tagaro::SpriteLayerItem::paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* widget)
+{
+	Q_UNUSED(widget)
+	const QSizeF size = d->m_instanceSize;
+	const QPointF center(size.width() / 2, size.height() / 2);
+	//Consecutive instances with the same pixmap are painted in one call. (The
+	//instances must be painted in order because they may overlap.)
+	QVector<QPainter::PixmapFragment> fragments;
+	QPixmap batchPixmap;
+	foreach (int index, instancesIn(option->exposedRect))
+	{
+		const QPixmap pixmap = d->m_instances[index].client->pixmap();
+		if (pixmap.isNull())
+		{
+			continue;
+		}
+		if (pixmap.cacheKey() != batchPixmap.cacheKey())
+		{
+			if (!fragments.isEmpty())
+			{
+				painter->drawPixmapFragments(fragments.constData(), fragments.count(), batchPixmap);
+				fragments.clear();
+			}
+			batchPixmap = pixmap;
+		}
+		fragments << QPainter::PixmapFragment::create(
+			d->m_instances[index].position + center,
+			QRectF(QPointF(), pixmap.size()),
+			size.width() / pixmap.width(), size.height() / pixmap.height()
+		);
+	}
+	if (!fragments.isEmpty())
+	{
+		painter->drawPixmapFragments(fragments.constData(), fragments.count(), batchPixmap);
+	}
+}
+
+//END QGraphicsItem reimplementation
+
+#include "spritelayeritem.moc"
@@ -0,0 +1,142 @@
+/***************************************************************************
+ *   Copyright 2011 Stefan Majewsky <majewsky@gmx.net>                     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef TAGARO_SPRITELAYERITEM_H
+#define TAGARO_SPRITELAYERITEM_H
+
+#include <QtCore/QObject>
+#include <QtGui/QGraphicsItem>
+
+#include <libtagaro_export.h>
+
+namespace Tagaro {
+
+class Sprite;
+
+/**
+ * @class Tagaro::SpriteLayerItem spritelayeritem.h <Tagaro/SpriteLayerItem>
+ * @short A QGraphicsObject which displays many sprites at once.
+ *
+ * Boards which consist of thousands of tiles should not use one
+ * Tagaro::SpriteObjectItem per tile: The overhead of the scene index, the
+ * transformations and the signal connections of all these items quickly
+ * dominates. A Tagaro::SpriteLayerItem instead holds a compact array of
+ * lightweight instances, each of which consists of a sprite, a frame, a
+ * position and a visibility flag. All instances have the same instanceSize().
+ *
+ * The instances are painted in one pass, in the order of their indices. Pixmap
+ * draws are batched with QPainter::drawPixmapFragments() for consecutive
+ * instances which show the same pixmap, so sorting the instances by sprite
+ * helps (as long as the instances in question do not overlap). Each distinct
+ * combination of sprite and frame is fetched by only one Tagaro::SpriteClient.
+ *
+ * The item keeps a spatial index of its instances, which is used for painting
+ * only the exposed instances, and for hit tests with instanceAt(). Like
+ * Tagaro::SpriteObjectItem, hit tests use the alpha masks of the pixmaps
+ * (see Tagaro::SpriteClient::isOpaqueAt).
+ *
+ * When inserted into a Tagaro::Board, the item is registered with the board
+ * once (instead of once per instance), and the board adjusts its renderSize()
+ * automatically.
+ */
+class TAGARO_EXPORT SpriteLayerItem : public QGraphicsObject
+{
+	Q_OBJECT
+	Q_PROPERTY(QSize renderSize READ renderSize WRITE setRenderSize)
+	Q_PROPERTY(QSizeF instanceSize READ instanceSize WRITE setInstanceSize NOTIFY instanceSizeChanged)
+	public:
+		///Creates a new Tagaro::SpriteLayerItem without any instances.
+		explicit SpriteLayerItem(QGraphicsItem* parent = 0);
+		virtual ~SpriteLayerItem();
+
+		///@return the size of each instance (in local coordinates)
+		QSizeF instanceSize() const;
+		///Sets the size of each instance (in local coordinates). The default
+		///is (1,1). The rendered pixmaps are scaled to this size, regardless
+		///of the render size.
+		void setInstanceSize(const QSizeF& size);
+		///@return the size of the pixmaps for the instances
+		QSize renderSize() const;
+		///Sets the size of the pixmaps for the instances. When the item is
+		///inserted into a Tagaro::Board, the board sets this automatically.
+		void setRenderSize(const QSize& size);
+
+		///Adds an instance which shows the given @a frame of the given
+		///@a sprite, with its top-left corner at the given @a position (in
+		///local coordinates). Returns the index of the new instance, which
+		///stays valid until the instance is removed.
+		///@note Indices of removed instances are reused.
+		int addInstance(Tagaro::Sprite* sprite, const QPointF& position, int frame = -1);
+		///Removes the instance with the given @a index.
+		void removeInstance(int index);
+		///Removes all instances.
+		void clearInstances();
+		///@return the number of instances (including removed instances whose
+		///index has not been reused yet)
+		int instanceCount() const;
+
+		///@return the sprite of the instance with the given @a index
+		Tagaro::Sprite* instanceSprite(int index) const;
+		///Sets the sprite of the instance with the given @a index.
+		void setInstanceSprite(int index, Tagaro::Sprite* sprite);
+		///@return the frame of the instance with the given @a index
+		int instanceFrame(int index) const;
+		///Sets the frame of the instance with the given @a index. As with
+		///Tagaro::SpriteClient::setFrame, the frame is normalized by taking
+		///the modulo of the sprite's frame count.
+		void setInstanceFrame(int index, int frame);
+		///@return the position of the top-left corner of the instance with
+		///the given @a index (in local coordinates)
+		QPointF instancePosition(int index) const;
+		///Moves the top-left corner of the instance with the given @a index to
+		///the given @a position (in local coordinates).
+		void setInstancePosition(int index, const QPointF& position);
+		///@return whether the instance with the given @a index is visible
+		bool isInstanceVisible(int index) const;
+		///Shows or hides the instance with the given @a index. Hidden
+		///instances are neither painted nor found by hit tests.
+		void setInstanceVisible(int index, bool visible);
+
+		///@return the index of the topmost visible instance which has an
+		///opaque pixel at the given @a point (in local coordinates), or -1 if
+		///there is no such instance
+		int instanceAt(const QPointF& point) const;
+		///@return the indices of all visible instances whose bounding rect
+		///intersects the given @a rect (in local coordinates), in ascending
+		///order
+		QList<int> instancesIn(const QRectF& rect) const;
+
+		virtual QRectF boundingRect() const;
+		virtual bool contains(const QPointF& point) const;
+		virtual void paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* widget = 0);
+	Q_SIGNALS:
+		///This signal is emitted when the size of the instances changes.
+		void instanceSizeChanged(const QSizeF& size);
+	protected:
+		virtual QVariant itemChange(QGraphicsItem::GraphicsItemChange change, const QVariant& value);
+	private:
+		friend class Board; // need access to drop item
+		friend class Scene; // need access to update render priority
+		friend class SpriteLayerClient; // need access to update instances
+		class Private;
+		Private* const d;
+};
+
+} //namespace Tagaro
+
+#endif // TAGARO_SPRITELAYERITEM_H
@@ -0,0 +1,107 @@
+/***************************************************************************
+ *   Copyright 2011 Stefan Majewsky <majewsky@gmx.net>                     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef TAGARO_SPRITELAYERITEM_P_H
+#define TAGARO_SPRITELAYERITEM_P_H
+
+#include "spritelayeritem.h"
+#include "spriteclient.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QPair>
+#include <QtCore/QSet>
+#include <QtCore/QVector>
+
+namespace Tagaro {
+
+class Board;
+
+//Fetches the pixmap for one combination of sprite and frame, on behalf of all
+//instances of a Tagaro::SpriteLayerItem which show this combination.
+class SpriteLayerClient : public Tagaro::SpriteClient
+{
+	public:
+		SpriteLayerClient(Tagaro::SpriteLayerItem* layer, Tagaro::Sprite* sprite, int frame);
+
+		QSet<int> m_instances; //indices of the instances using this client
+	protected:
+		virtual void receivePixmap(const QPixmap& pixmap);
+	private:
+		Tagaro::SpriteLayerItem* m_layer;
+};
+
+} //namespace Tagaro
+
+class Tagaro::SpriteLayerItem::Private
+{
+	public:
+		struct Instance
+		{
+			Tagaro::SpriteLayerClient* client; //0 for removed instances
+			QPointF position;
+			bool visible;
+		};
+		typedef QPair<int, int> Cell;
+
+		Private(Tagaro::SpriteLayerItem* q);
+		~Private();
+
+		//returns 0 for invalid indices and removed instances
+		Tagaro::SpriteLayerItem::Private::Instance* instance(int index);
+		const Tagaro::SpriteLayerItem::Private::Instance* instance(int index) const;
+		inline QRectF instanceRect(const Tagaro::SpriteLayerItem::Private::Instance& instance) const { return QRectF(instance.position, m_instanceSize); }
+
+		//The clients are shared between all instances with the same sprite and
+		//frame. Each client knows its instances, so that only these are
+		//repainted when the client receives a new pixmap.
+		Tagaro::SpriteLayerClient* acquireClient(Tagaro::Sprite* sprite, int frame, int index);
+		void releaseClient(Tagaro::SpriteLayerClient* client, int index);
+
+		//Spatial index: The item is divided into cells of m_instanceSize, and
+		//each cell lists the instances which intersect it (usually up to four
+		//per cell for boards of tiles).
+		Tagaro::SpriteLayerItem::Private::Cell cellAt(const QPointF& point) const;
+		void indexInstance(int index);
+		void unindexInstance(int index);
+		void rebuildIndex();
+		//grows the bounding rect if necessary to include the given rect
+		void includeRect(const QRectF& rect);
+
+		//relation to Tagaro::Board
+		Tagaro::Board* m_board;
+		void findBoardFromParent(QGraphicsItem* parent);
+		inline void unsetBoard() {m_board = 0;}
+
+		//derives the render priority from the item's visibility
+		void updateRenderPriority();
+
+		Tagaro::SpriteLayerItem* q;
+		QSizeF m_instanceSize;
+		QSize m_renderSize;
+		Tagaro::RenderScheduler::Priority m_priority;
+		//The bounding rect is only grown when instances are added or moved,
+		//so that the scene index is not updated for every change.
+		QRectF m_boundingRect;
+
+		QVector<Tagaro::SpriteLayerItem::Private::Instance> m_instances;
+		QList<int> m_freeIndices; //of removed instances
+		QHash<Tagaro::SpriteLayerItem::Private::Cell, QVector<int> > m_index;
+		QHash<QPair<Tagaro::Sprite*, int>, Tagaro::SpriteLayerClient*> m_clients;
+};
+
+#endif // TAGARO_SPRITELAYERITEM_P_H
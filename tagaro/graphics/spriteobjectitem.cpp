@@ -19,9 +19,11 @@
 #include "spriteobjectitem.h"
 #include "spriteobjectitem_p.h"
 #include "../interface/board_p.h"
+#include "../interface/scene.h"
 
 #include <QtCore/qmath.h>
 #include <QtGui/QGraphicsScene>
+#include <QtGui/QGraphicsView>
 
 static QPixmap dummyPixmap()
 {
@@ -49,7 +51,10 @@ Tagaro::SpriteObjectItem::SpriteObjectItem(Tagaro::Sprite* sprite, QGraphicsItem
 	, Tagaro::SpriteClient(sprite)
 	, d(new Private(this))
 {
+	//itemChange() needs to know about movements to update the render priority
+	setFlag(QGraphicsItem::ItemSendsGeometryChanges);
 	d->findBoardFromParent(this, parent);
+	d->updateRenderPriority(this);
 }
 
 Tagaro::SpriteObjectItem::~SpriteObjectItem()
@@ -92,13 +97,56 @@ void Tagaro::SpriteObjectItem::Private::findBoardFromParent(Tagaro::SpriteObject
 
 QVariant Tagaro::SpriteObjectItem::itemChange(QGraphicsItem::GraphicsItemChange change, const QVariant& value)
 {
-	if (change == QGraphicsItem::ItemParentChange)
+	switch (change)
 	{
-		d->findBoardFromParent(this, value.value<QGraphicsItem*>());
+		case QGraphicsItem::ItemParentChange:
+			d->findBoardFromParent(this, value.value<QGraphicsItem*>());
+			break;
+		case QGraphicsItem::ItemSceneHasChanged:
+		case QGraphicsItem::ItemVisibleHasChanged:
+		case QGraphicsItem::ItemPositionHasChanged:
+		case QGraphicsItem::ItemTransformHasChanged:
+			d->updateRenderPriority(this);
+			break;
+		default:
+			break;
 	}
 	return QGraphicsObject::itemChange(change, value);
 }
 
+void Tagaro::SpriteObjectItem::Private::updateRenderPriority(Tagaro::SpriteObjectItem* q)
+{
+	q->setRenderPriority(renderPriority(q));
+}
+
+Tagaro::RenderScheduler::Priority Tagaro::SpriteObjectItem::Private::renderPriority(const QGraphicsItem* item)
+{
+	Tagaro::RenderScheduler::Priority priority = Tagaro::RenderScheduler::VisiblePriority;
+	QGraphicsScene* scene = item->scene();
+	//Only Tagaro::Scene knows which view is the relevant one. Items in other
+	//scenes are always considered visible.
+	Tagaro::Scene* tagaroScene = qobject_cast<Tagaro::Scene*>(scene);
+	QGraphicsView* view = tagaroScene ? tagaroScene->mainView() : 0;
+	if (!scene || !item->isVisible() || (view && (view->visibleRegion().isEmpty() || view->window()->isMinimized())))
+	{
+		//not shown anywhere -> render only when nothing else is to be done
+		//(this also suspends animations)
+		priority = Tagaro::RenderScheduler::WarmupPriority;
+	}
+	else
+	{
+		if (view)
+		{
+			const QRectF viewRect = view->mapToScene(view->viewport()->rect()).boundingRect();
+			if (!viewRect.intersects(item->sceneBoundingRect()))
+			{
+				priority = Tagaro::RenderScheduler::NearlyVisiblePriority;
+			}
+		}
+	}
+	return priority;
+}
+
 QPointF Tagaro::SpriteObjectItem::offset() const
 {
 	return d->pos();
@@ -110,6 +158,7 @@ void Tagaro::SpriteObjectItem::setOffset(const QPointF& offset)
 	{
 		prepareGeometryChange();
 		d->setPos(offset);
+		d->updateRenderPriority(this);
 		update();
 	}
 }
@@ -126,6 +175,7 @@ void Tagaro::SpriteObjectItem::setSize(const QSizeF& size)
 		prepareGeometryChange();
 		d->m_size = size;
 		d->updateTransform();
+		d->updateRenderPriority(this);
 		emit sizeChanged(size);
 		update();
 	}
@@ -177,11 +227,9 @@ bool Tagaro::SpriteObjectItem::contains(const QPointF& point) const
 	//return d->QGraphicsPixmapItem::contains(d->mapFromParent(point));
 	//This does not work because QGraphicsPixmapItem::contains is actually not
 	//implemented. (It is, but it just calls QGraphicsItem::contains as of 4.7.)
-	const QPixmap& pixmap = d->pixmap();
-	if (pixmap.isNull())
-		return false;
-	const QPoint pixmapPoint = d->mapFromParent(point).toPoint();
-	return pixmap.copy(QRect(pixmapPoint, QSize(1, 1))).toImage().pixel(0, 0);
+	//Reading back the pixel from the pixmap is too slow for hover tracking,
+	//so the precomputed alpha mask of the pixmap is used instead.
+	return isOpaqueAt(d->mapFromParent(point));
 }
 
 bool Tagaro::SpriteObjectItem::isObscuredBy(const QGraphicsItem* item) const
@@ -201,7 +249,9 @@ void Tagaro::SpriteObjectItem::paint(QPainter* painter, const QStyleOptionGraphi
 
 QPainterPath Tagaro::SpriteObjectItem::shape() const
 {
-	return d->mapToParent(d->QGraphicsPixmapItem::shape());
+	//QGraphicsPixmapItem::shape() would create the shape from the pixmap's
+	//mask on every pixmap change. The traced outline comes with the pixmap.
+	return d->mapToParent(opaqueShape());
 }
 
 //END QGraphicsItem reimplementation of Tagaro::SpriteObjectItem
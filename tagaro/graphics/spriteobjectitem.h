@@ -91,6 +91,7 @@ class TAGARO_EXPORT SpriteObjectItem : public QGraphicsObject, public Tagaro::Sp
 		virtual void receivePixmap(const QPixmap& pixmap);
 	private:
 		friend class Board; // need access to drop item
+		friend class Scene; // need access to update render priority
 		class Private;
 		Private* const d;
 };
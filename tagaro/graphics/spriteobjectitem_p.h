@@ -39,6 +39,12 @@ class Tagaro::SpriteObjectItem::Private : public QGraphicsPixmapItem
 		void findBoardFromParent(Tagaro::SpriteObjectItem* q, QGraphicsItem* parent);
 		inline void unsetBoard() {m_board = 0;}
 
+		//derives the render priority from the item's visibility
+		void updateRenderPriority(Tagaro::SpriteObjectItem* q);
+		//the rule behind updateRenderPriority() (also used by
+		//Tagaro::SpriteLayerItem)
+		static Tagaro::RenderScheduler::Priority renderPriority(const QGraphicsItem* item);
+
 		//QGraphicsItem reimplementations (see comment below for why we need all of this)
 		virtual bool contains(const QPointF& point) const;
 		virtual bool isObscuredBy(const QGraphicsItem* item) const;
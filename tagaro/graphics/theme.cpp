@@ -19,6 +19,7 @@
 
 #include "theme.h"
 #include "graphicssources.h"
+#include "sprite_p.h"
 #include "themeprovider.h"
 
 #include <QtCore/QFileInfo>
@@ -53,9 +54,18 @@ struct Tagaro::Theme::Private
 	QList<ThemeMapping> m_mappings;
 
 	Private(const QByteArray& identifier, const Tagaro::ThemeProvider* provider) : m_identifier(identifier), m_provider(provider) {}
-	~Private() { qDeleteAll(m_sources); }
+	~Private();
 };
 
+Tagaro::Theme::Private::~Private()
+{
+	//the sources might still be in use by rendering threads
+	foreach (Tagaro::GraphicsSource* source, m_sources)
+	{
+		Tagaro::RenderJobTable::releaseSource(source);
+	}
+}
+
 Tagaro::Theme::Theme(const QByteArray& identifier, const Tagaro::ThemeProvider* provider)
 	: d(new Private(identifier, provider))
 {
@@ -155,7 +165,7 @@ void Tagaro::Theme::addSource(const QByteArray& identifier_, Tagaro::GraphicsSou
 	QHash<QByteArray, Tagaro::GraphicsSource*>::const_iterator it = d->m_sources.constFind(identifier);
 	if (it != d->m_sources.constEnd())
 	{
-		delete it.value();
+		Tagaro::RenderJobTable::releaseSource(it.value());
 	}
 	d->m_sources.insert(identifier, source);
 }
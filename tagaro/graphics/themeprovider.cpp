@@ -19,14 +19,17 @@
 #include "themeprovider.h"
 #include "graphicsdelegate_p.h"
 #include "graphicssource.h"
-#include "settings.h"
+#include "renderrecorder_p.h"
 #include "sprite.h"
 #include "sprite_p.h"
 #include "theme.h"
 
 #include <QtCore/QAbstractListModel>
+#include <QtCore/QBasicTimer>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QFileInfo>
-#include <QtCore/QThreadPool>
+#include <QtCore/QSet>
+#include <QtCore/QTimerEvent>
 #include <QtCore/QVector>
 #include <KDE/KConfig>
 #include <KDE/KConfigGroup>
@@ -35,23 +38,39 @@
 
 //BEGIN Tagaro::ThemeProvider
 
-class Tagaro::ThemeProvider::Private : public QAbstractListModel
+class Tagaro::ThemeProvider::Private : public QAbstractListModel, public Tagaro::SpriteRegistry
 {
 	public:
 		Tagaro::ThemeProvider* q;
 		bool m_ownThemes;
 		Tagaro::GraphicsSourceConfig m_config;
 		QHash<QString, Tagaro::Sprite*> m_sprites;
+		//sprites which have clients (only these are remapped on theme changes)
+		QSet<Tagaro::Sprite*> m_liveSprites;
+
+		//sprites without clients, with the time at which they were last used
+		//(only tracked if the grace period is not negative)
+		QHash<Tagaro::Sprite*, qint64> m_unusedSince;
+		int m_gracePeriod;
+		QBasicTimer m_evictionTimer;
+		QElapsedTimer m_clock;
 
 		QList<Tagaro::Theme*> m_themes;
 		QList<const Tagaro::Theme*> m_cThemes;
 		const Tagaro::Theme* m_selectedTheme;
 
-		Private(Tagaro::ThemeProvider* q, bool ownThemes, const Tagaro::GraphicsSourceConfig& config) : QAbstractListModel(q), q(q), m_ownThemes(ownThemes), m_config(config), m_selectedTheme(0) {}
+		Private(Tagaro::ThemeProvider* q, bool ownThemes, const Tagaro::GraphicsSourceConfig& config) : QAbstractListModel(q), q(q), m_ownThemes(ownThemes), m_config(config), m_gracePeriod(-1), m_selectedTheme(0) { m_clock.start(); }
 
 		virtual QVariant data(const QModelIndex& index, int role) const;
 		virtual Qt::ItemFlags flags(const QModelIndex& index) const;
 		virtual int rowCount(const QModelIndex& index) const;
+
+		virtual void mapSprite(Tagaro::Sprite* sprite);
+		virtual void setSpriteUsed(Tagaro::Sprite* sprite, bool used);
+		//Starts the grace period of the given sprite (again).
+		void markUnused(Tagaro::Sprite* sprite);
+	protected:
+		virtual void timerEvent(QTimerEvent* event);
 	private:
 		friend class Tagaro::ThemeProvider;
 };
@@ -91,6 +110,93 @@ int Tagaro::ThemeProvider::Private::rowCount(const QModelIndex& index) const
 	return index.isValid() ? 0 : m_cThemes.count();
 }
 
+void Tagaro::ThemeProvider::Private::mapSprite(Tagaro::Sprite* sprite)
+{
+	Tagaro::Sprite::Private* spriteData = sprite->d;
+	spriteData->m_generation = m_generation;
+	if (m_selectedTheme)
+	{
+		const QPair<const Tagaro::GraphicsSource*, QString> renderElement = m_selectedTheme->mapSpriteKey(spriteData->m_key);
+		spriteData->setSource(renderElement.first, renderElement.second);
+	}
+	else
+	{
+		spriteData->setSource(0, QString());
+	}
+}
+
+void Tagaro::ThemeProvider::Private::setSpriteUsed(Tagaro::Sprite* sprite, bool used)
+{
+	if (used)
+	{
+		m_liveSprites.insert(sprite);
+		m_unusedSince.remove(sprite);
+	}
+	else
+	{
+		m_liveSprites.remove(sprite);
+		markUnused(sprite);
+	}
+}
+
+void Tagaro::ThemeProvider::Private::markUnused(Tagaro::Sprite* sprite)
+{
+	if (m_gracePeriod < 0)
+	{
+		return;
+	}
+	m_unusedSince.insert(sprite, m_clock.elapsed());
+	//If the timer is running, it fires before this grace period ends.
+	if (!m_evictionTimer.isActive())
+	{
+		m_evictionTimer.start(m_gracePeriod, this);
+	}
+}
+
+void Tagaro::ThemeProvider::Private::timerEvent(QTimerEvent* event)
+{
+	if (event->timerId() != m_evictionTimer.timerId())
+	{
+		QAbstractListModel::timerEvent(event);
+		return;
+	}
+	m_evictionTimer.stop();
+	const qint64 now = m_clock.elapsed();
+	qint64 nextDeadline = -1;
+	QSet<QPair<const Tagaro::GraphicsSource*, QString> > releasedElements;
+	QHash<Tagaro::Sprite*, qint64>::iterator it = m_unusedSince.begin();
+	while (it != m_unusedSince.end())
+	{
+		const qint64 deadline = it.value() + m_gracePeriod;
+		if (deadline > now)
+		{
+			nextDeadline = nextDeadline < 0 ? deadline : qMin(nextDeadline, deadline);
+			++it;
+			continue;
+		}
+		//evict sprite (its fetchers and pixmaps are released below, unless
+		//they are shared with other sprites which still have clients)
+		Tagaro::Sprite* sprite = it.key();
+		it = m_unusedSince.erase(it);
+		if (sprite->d->m_generation == m_generation)
+		{
+			//the source of an outdated mapping might not exist anymore
+			releasedElements.insert(qMakePair(sprite->d->m_source, sprite->d->m_element));
+		}
+		m_sprites.remove(sprite->d->m_key);
+		sprite->d->m_registry = 0;
+		delete sprite;
+	}
+	if (!releasedElements.isEmpty())
+	{
+		Tagaro::SpriteFetcherPool::instance()->releaseElements(releasedElements);
+	}
+	if (nextDeadline >= 0)
+	{
+		m_evictionTimer.start(nextDeadline - now, this);
+	}
+}
+
 Tagaro::ThemeProvider::ThemeProvider(bool ownThemes, QObject* parent, const Tagaro::GraphicsSourceConfig& config)
 	: QObject(parent)
 	, d(new Private(this, ownThemes, config))
@@ -103,7 +209,11 @@ Tagaro::ThemeProvider::~ThemeProvider()
 	QHash<QString, Tagaro::Sprite*>::const_iterator it1 = d->m_sprites.constBegin(),
 	                                                it2 = d->m_sprites.constEnd();
 	for (; it1 != it2; ++it1)
+	{
+		//do not report the disconnection of clients back to us
+		it1.value()->d->m_registry = 0;
 		delete it1.value();
+	}
 	//cleanup themes
 	if (d->m_ownThemes)
 	{
@@ -120,17 +230,46 @@ Tagaro::Sprite* Tagaro::ThemeProvider::sprite(const QString& spriteKey) const
 	{
 		//instantiate on first use
 		sprite = new Tagaro::Sprite;
-		if (d->m_selectedTheme)
-		{
-			const QPair<const Tagaro::GraphicsSource*, QString> renderElement = d->m_selectedTheme->mapSpriteKey(spriteKey);
-			sprite->d->setSource(renderElement.first, renderElement.second);
-		}
-		else
+		sprite->d->m_registry = d;
+		sprite->d->m_key = spriteKey;
+		d->mapSprite(sprite);
+	}
+	//the caller will probably use the sprite soon, so restart its grace period
+	if (!d->m_liveSprites.contains(sprite))
+	{
+		d->markUnused(sprite);
+	}
+	return sprite;
+}
+
+int Tagaro::ThemeProvider::spriteGracePeriod() const
+{
+	return d->m_gracePeriod;
+}
+
+void Tagaro::ThemeProvider::setSpriteGracePeriod(int gracePeriod)
+{
+	gracePeriod = qMax(-1, gracePeriod);
+	if (d->m_gracePeriod == gracePeriod)
+	{
+		return;
+	}
+	d->m_gracePeriod = gracePeriod;
+	d->m_unusedSince.clear();
+	d->m_evictionTimer.stop();
+	if (gracePeriod < 0)
+	{
+		return;
+	}
+	//the grace period of all sprites without clients starts now
+	QHash<QString, Tagaro::Sprite*>::const_iterator it1 = d->m_sprites.constBegin(), it2 = d->m_sprites.constEnd();
+	for (; it1 != it2; ++it1)
+	{
+		if (!d->m_liveSprites.contains(it1.value()))
 		{
-			sprite->d->setSource(0, QString());
+			d->markUnused(it1.value());
 		}
 	}
-	return sprite;
 }
 
 QAbstractItemModel* Tagaro::ThemeProvider::model() const
@@ -171,19 +310,22 @@ void Tagaro::ThemeProvider::setSelectedTheme(const Tagaro::Theme* theme)
 	}
 	if (d->m_selectedTheme != theme && theme->isValid())
 	{
-		//if necessary, clear rendering threads
-		if (Tagaro::Settings::useRenderingThreads())
+		//do theme change (Rendering jobs for the old theme need not be waited
+		//for: The sprites withdraw their requests when their source changes,
+		//so results for the old theme are discarded. Clients keep showing
+		//their old pixmaps until the new ones arrive.)
+		d->m_selectedTheme = theme;
+		if (Tagaro::RenderRecorder* recorder = Tagaro::RenderRecorder::instance())
 		{
-			QThreadPool::globalInstance()->waitForDone(); //TODO: optimize
+			recorder->record("theme", Tagaro::RenderRecorder::encode(QString::fromUtf8(theme->identifier())));
 		}
-		//do theme change
-		d->m_selectedTheme = theme;
-		//announce change to sprites
-		QHash<QString, Tagaro::Sprite*>::const_iterator it1 = d->m_sprites.constBegin(), it2 = d->m_sprites.constEnd();
-		for (; it1 != it2; ++it1)
+		//announce change to sprites (Only sprites with clients are remapped
+		//now. The others remap themselves when they are used again.)
+		++d->m_generation;
+		const QList<Tagaro::Sprite*> liveSprites = d->m_liveSprites.toList();
+		foreach (Tagaro::Sprite* sprite, liveSprites)
 		{
-			const QPair<const Tagaro::GraphicsSource*, QString> renderElement = theme->mapSpriteKey(it1.key());
-			it1.value()->d->setSource(renderElement.first, renderElement.second);
+			d->mapSprite(sprite);
 		}
 		//announce change publicly (AFTER announce to sprites, because slots
 		//connected to this signal may want to refetch synchronous pixmaps)
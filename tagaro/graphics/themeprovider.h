@@ -67,6 +67,21 @@ class TAGARO_EXPORT ThemeProvider : public QObject
 		///
 		///The @a spriteKey may not contain "@" characters.
 		Tagaro::Sprite* sprite(const QString& spriteKey) const;
+		///@return the time (in milliseconds) after which sprites without
+		///clients are deleted, or -1 if sprites are kept until the provider
+		///is deleted (the default)
+		int spriteGracePeriod() const;
+		///Sets the time (in milliseconds) after which sprites are deleted
+		///when they have no Tagaro::SpriteClient instances. The pixmaps of
+		///deleted sprites are dropped from the caches. Use this for
+		///long-running applications which request many different sprites
+		///over time (e.g. one set of sprites per level).
+		///
+		///A negative @a gracePeriod disables the deletion of sprites.
+		///@warning If the grace period is not negative, do not store pointers
+		///to sprites without clients: Ask sprite() again instead, which also
+		///restarts the grace period of the sprite.
+		void setSpriteGracePeriod(int gracePeriod);
 
 		///@return a list-shaped model exposing the themes' data
 		QAbstractItemModel* model() const;
@@ -18,6 +18,8 @@
 
 #include "board.h"
 #include "board_p.h"
+#include "../graphics/spritelayeritem.h"
+#include "../graphics/spritelayeritem_p.h"
 #include "../graphics/spriteobjectitem.h"
 #include "../graphics/spriteobjectitem_p.h"
 
@@ -44,6 +46,8 @@ Tagaro::Board::Private::~Private()
 {
 	for(QList<Tagaro::SpriteObjectItem*>::const_iterator a = m_items.constBegin(); a != m_items.constEnd(); ++a)
 		(*a)->d->unsetBoard();
+	foreach (Tagaro::SpriteLayerItem* layer, m_layers)
+		layer->d->unsetBoard();
 }
 
 QSizeF Tagaro::Board::logicalSize() const
@@ -160,15 +164,21 @@ void Tagaro::Board::Private::_k_update()
 	QList<Tagaro::SpriteObjectItem*>::const_iterator it1 = m_items.constBegin(), it2 = m_items.constEnd();
 	for (; it1 != it2; ++it1)
 		update(*it1);
+	foreach (Tagaro::SpriteLayerItem* layer, m_layers)
+		update(layer);
 }
 
 void Tagaro::Board::Private::_k_updateItem()
 {
-	Tagaro::SpriteObjectItem* item = qobject_cast<Tagaro::SpriteObjectItem*>(m_board->sender());
-	if (item)
+	QObject* sender = m_board->sender();
+	if (Tagaro::SpriteObjectItem* item = qobject_cast<Tagaro::SpriteObjectItem*>(sender))
 	{
 		update(item);
 	}
+	else if (Tagaro::SpriteLayerItem* layer = qobject_cast<Tagaro::SpriteLayerItem*>(sender))
+	{
+		update(layer);
+	}
 }
 
 void Tagaro::Board::Private::update(Tagaro::SpriteObjectItem* item)
@@ -184,9 +194,25 @@ void Tagaro::Board::Private::update(Tagaro::SpriteObjectItem* item)
 	}
 	size.rwidth() *= m_renderSizeFactor.x();
 	size.rheight() *= m_renderSizeFactor.y();
+	//the board layout may have moved the item into or out of the view
+	item->d->updateRenderPriority(item);
 	item->setRenderSize(size.toSize());
 }
 
+void Tagaro::Board::Private::update(Tagaro::SpriteLayerItem* layer)
+{
+	//all instances of the layer have the same size
+	QSizeF size = layer->instanceSize();
+	if (layer->parentItem() != m_board)
+	{
+		size = m_board->mapRectFromItem(layer, QRectF(QPointF(), size)).size();
+	}
+	size.rwidth() *= m_renderSizeFactor.x();
+	size.rheight() *= m_renderSizeFactor.y();
+	layer->d->updateRenderPriority();
+	layer->setRenderSize(size.toSize());
+}
+
 QRectF Tagaro::Board::boundingRect() const
 {
 	return QRectF(QPointF(), d->m_size);
@@ -210,6 +236,19 @@ void Tagaro::Board::Private::unregisterItem(Tagaro::SpriteObjectItem* item)
 	m_items.removeAll(item);
 }
 
+void Tagaro::Board::Private::registerLayer(Tagaro::SpriteLayerItem* layer)
+{
+	m_layers << layer;
+	connect(layer, SIGNAL(instanceSizeChanged(QSizeF)), m_board, SLOT(_k_updateItem()));
+	update(layer);
+}
+
+void Tagaro::Board::Private::unregisterLayer(Tagaro::SpriteLayerItem* layer)
+{
+	disconnect(layer, 0, m_board, 0);
+	m_layers.removeAll(layer);
+}
+
 QVariant Tagaro::Board::itemChange(QGraphicsItem::GraphicsItemChange change, const QVariant& value)
 {
 	if (change == ItemSceneChange)
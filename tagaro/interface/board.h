@@ -25,6 +25,7 @@
 
 namespace Tagaro {
 
+class SpriteLayerItem;
 class SpriteObjectItem;
 
 /**
@@ -36,7 +37,8 @@ class SpriteObjectItem;
  *     parent item (or the scene rect, if there is no parent item). This
  *     behavior is controlled by the alignment() property.
  * @li When it is resized, it will automatically adjust the renderSize of any
- *     contained Tagaro::SpriteObjectItem instances.
+ *     contained Tagaro::SpriteObjectItem and Tagaro::SpriteLayerItem
+ *     instances.
  */
 class TAGARO_EXPORT Board : public QGraphicsObject
 {
@@ -102,6 +104,7 @@ class TAGARO_EXPORT Board : public QGraphicsObject
 	protected:
 		virtual QVariant itemChange(QGraphicsItem::GraphicsItemChange change, const QVariant& value);
 	private:
+		friend class Tagaro::SpriteLayerItem; //needs access to d->{,un}registerLayer
 		friend class Tagaro::SpriteObjectItem; //needs access to d->{,un}registerItem
 		class Private;
 		Private* const d;
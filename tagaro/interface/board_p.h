@@ -32,9 +32,11 @@ class Tagaro::Board::Private
 	QPointF m_renderSizeFactor;
 
 	QList<Tagaro::SpriteObjectItem*> m_items;
+	QList<Tagaro::SpriteLayerItem*> m_layers;
 
 	void _k_update();
 	void update(Tagaro::SpriteObjectItem* item);
+	void update(Tagaro::SpriteLayerItem* layer);
 	void _k_updateItem();
 
 	Private(Tagaro::Board* board) : m_board(board), m_alignment(Qt::AlignCenter), m_logicalSize(1, 1), m_size(1, 1), m_physicalSizeFactor(1), m_renderSizeFactor(1, 1) {}
@@ -43,6 +45,9 @@ class Tagaro::Board::Private
 	public: //interface to Tagaro::SpriteObjectItem
 		void registerItem(Tagaro::SpriteObjectItem* item);
 		void unregisterItem(Tagaro::SpriteObjectItem* item);
+	public: //interface to Tagaro::SpriteLayerItem
+		void registerLayer(Tagaro::SpriteLayerItem* layer);
+		void unregisterLayer(Tagaro::SpriteLayerItem* layer);
 };
 
 #endif // TAGARO_BOARD_P_H
@@ -19,10 +19,16 @@
 #include "scene.h"
 #include "scene_p.h"
 #include "messageoverlay.h"
+#include "../graphics/spritelayeritem.h"
+#include "../graphics/spritelayeritem_p.h"
+#include "../graphics/spriteobjectitem.h"
+#include "../graphics/spriteobjectitem_p.h"
 
 #include <QtCore/QEvent>
+#include <QtCore/QSet>
 #include <QtGui/QGraphicsTextItem>
 #include <QtGui/QGraphicsView>
+#include <QtGui/QScrollBar>
 #include <QtGui/QStyleOptionGraphicsItem>
 #include <QtGui/QTextDocument>
 
@@ -32,6 +38,7 @@ Tagaro::Scene::Private::Private(Tagaro::Sprite* backgroundSprite, Tagaro::Scene*
 	, m_mainView(0)
 	, m_renderSize() //constructed with invalid size (as documented)
 	, m_adjustingSceneRect(false)
+	, m_renderPrioritiesPending(false)
 	, m_currentOverlay(0)
 {
 	connect(parent, SIGNAL(sceneRectChanged(QRectF)), parent, SLOT(_k_updateSceneRect(QRectF)));
@@ -71,6 +78,8 @@ void Tagaro::Scene::setMainView(QGraphicsView* mainView)
 	if (d->m_mainView)
 	{
 		d->m_mainView->removeEventFilter(this);
+		disconnect(d->m_mainView->horizontalScrollBar(), 0, this, 0);
+		disconnect(d->m_mainView->verticalScrollBar(), 0, this, 0);
 	}
 	//connect to new main view
 	if ((d->m_mainView = mainView))
@@ -80,7 +89,15 @@ void Tagaro::Scene::setMainView(QGraphicsView* mainView)
 		d->m_mainView->setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
 		d->_k_resetSceneRect();
 		d->m_mainView->installEventFilter(this);
+		//The scroll bars are hidden, but still track the visible part of the
+		//scene. Their ranges change when the view is transformed.
+		foreach (QScrollBar* scrollBar, QList<QScrollBar*>() << d->m_mainView->horizontalScrollBar() << d->m_mainView->verticalScrollBar())
+		{
+			connect(scrollBar, SIGNAL(valueChanged(int)), this, SLOT(_k_viewChanged()));
+			connect(scrollBar, SIGNAL(rangeChanged(int,int)), this, SLOT(_k_viewChanged()));
+		}
 	}
+	d->updateRenderPriorities();
 }
 
 bool Tagaro::Scene::Private::_k_resetSceneRect()
@@ -99,13 +116,105 @@ bool Tagaro::Scene::Private::_k_resetSceneRect()
 
 bool Tagaro::Scene::eventFilter(QObject* watched, QEvent* event)
 {
-	if (watched == d->m_mainView && event->type() == QEvent::Resize)
+	if (watched == d->m_mainView)
 	{
-		d->_k_resetSceneRect();
+		switch (event->type())
+		{
+			case QEvent::Resize:
+				d->_k_resetSceneRect();
+				d->_k_viewChanged();
+				break;
+			case QEvent::Show:
+			case QEvent::Hide:
+				//suspend or resume rendering and animations
+				d->updateRenderPriorities();
+				break;
+			default:
+				break;
+		}
 	}
 	return QGraphicsScene::eventFilter(watched, event);
 }
 
+void Tagaro::Scene::Private::_k_viewChanged()
+{
+	//scrolling emits many signals in a row
+	if (!m_renderPrioritiesPending)
+	{
+		m_renderPrioritiesPending = true;
+		QMetaObject::invokeMethod(m_parent, "_k_updateRenderPriorities", Qt::QueuedConnection);
+	}
+}
+
+static void updateItemRenderPriority(QGraphicsItem* item)
+{
+	QGraphicsObject* object = item->toGraphicsObject();
+	Tagaro::SpriteObjectItem* spriteItem = object ? qobject_cast<Tagaro::SpriteObjectItem*>(object) : 0;
+	if (spriteItem)
+	{
+		spriteItem->d->updateRenderPriority(spriteItem);
+	}
+	else if (Tagaro::SpriteLayerItem* layer = object ? qobject_cast<Tagaro::SpriteLayerItem*>(object) : 0)
+	{
+		layer->d->updateRenderPriority();
+	}
+}
+
+QRectF Tagaro::Scene::Private::visibleSceneRect() const
+{
+	//same rect as in Tagaro::SpriteObjectItem::Private::renderPriority()
+	return m_mainView ? m_mainView->mapToScene(m_mainView->viewport()->rect()).boundingRect() : QRectF();
+}
+
+void Tagaro::Scene::Private::_k_updateRenderPriorities()
+{
+	if (!m_renderPrioritiesPending)
+	{
+		return;
+	}
+	m_renderPrioritiesPending = false;
+	//Scrolling only moves items between the visible and the nearly visible
+	//priority, so only items intersecting exactly one of the old and the new
+	//visible rect can change. (Items moving by themselves update their
+	//priority on their own, so the old set is queried again instead of being
+	//remembered.)
+	const QRectF oldRect = m_visibleRect;
+	const QRectF newRect = m_visibleRect = visibleSceneRect();
+	if (oldRect == newRect)
+	{
+		return;
+	}
+	if (oldRect.isEmpty() || newRect.isEmpty())
+	{
+		//the view was (or is now) collapsed, which affects all items
+		updateRenderPriorities();
+		return;
+	}
+	QSet<QGraphicsItem*> newItems = m_parent->items(newRect, Qt::IntersectsItemBoundingRect).toSet();
+	const QList<QGraphicsItem*> oldItems = m_parent->items(oldRect, Qt::IntersectsItemBoundingRect);
+	foreach (QGraphicsItem* item, oldItems)
+	{
+		if (!newItems.remove(item))
+		{
+			updateItemRenderPriority(item); //leaving the view
+		}
+	}
+	foreach (QGraphicsItem* item, newItems)
+	{
+		updateItemRenderPriority(item); //entering the view
+	}
+}
+
+void Tagaro::Scene::Private::updateRenderPriorities()
+{
+	m_renderPrioritiesPending = false;
+	m_visibleRect = visibleSceneRect();
+	foreach (QGraphicsItem* item, m_parent->items())
+	{
+		updateItemRenderPriority(item);
+	}
+}
+
 void Tagaro::Scene::Private::_k_updateSceneRect(const QRectF& rect)
 {
 	if (!_k_resetSceneRect())
@@ -90,6 +90,8 @@ class TAGARO_EXPORT Scene : public QGraphicsScene
 		class Private;
 		Private* const d;
 		Q_PRIVATE_SLOT(d, void _k_updateSceneRect(const QRectF&));
+		Q_PRIVATE_SLOT(d, void _k_viewChanged());
+		Q_PRIVATE_SLOT(d, void _k_updateRenderPriorities());
 		Q_PRIVATE_SLOT(d, void _k_moDestroyed(QObject*));
 		Q_PRIVATE_SLOT(d, void _k_moTextChanged(const QString&));
 		Q_PRIVATE_SLOT(d, void _k_moVisibleChanged(bool));
@@ -31,6 +31,14 @@ struct Tagaro::Scene::Private : public Tagaro::SpriteClient
 		bool _k_resetSceneRect();
 		void _k_updateSceneRect(const QRectF& rect);
 		inline void updateRenderSize(const QSize& sceneSize);
+		//called when the main view is changed, shown or hidden
+		void updateRenderPriorities();
+		//called when the main view is resized, scrolled or transformed (via
+		//_k_viewChanged(), which defers the update to the next event loop
+		//iteration); only visits the items entering or leaving the view
+		void _k_viewChanged();
+		void _k_updateRenderPriorities();
+		QRectF visibleSceneRect() const;
 
 		//interface to Tagaro::MessageOverlay
 		void addMessageOverlay(Tagaro::MessageOverlay* overlay);
@@ -42,6 +50,8 @@ struct Tagaro::Scene::Private : public Tagaro::SpriteClient
 		QGraphicsView* m_mainView;
 		QSize m_renderSize;
 		bool m_adjustingSceneRect;
+		bool m_renderPrioritiesPending;
+		QRectF m_visibleRect; //as of the last priority update
 
 		QList<Tagaro::MessageOverlay*> m_overlays;
 		Tagaro::MessageOverlay* m_currentOverlay;
@@ -0,0 +1,56 @@
+/***************************************************************************
+ *   Copyright 2011 Stefan Majewsky <majewsky@gmx.net>                     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef TAGARO_TOOLS_MEMORYUSAGE_H
+#define TAGARO_TOOLS_MEMORYUSAGE_H
+
+//Memory measurements which are shared by the benchmarking tools.
+
+#include <QtCore/QFile>
+
+//Resets the peak resident set size of this process (supported by Linux
+//since 4.0). If this fails, the reported peak is the peak of the process.
+static inline void resetPeakMemory()
+{
+	QFile file(QLatin1String("/proc/self/clear_refs"));
+	if (file.open(QIODevice::WriteOnly))
+	{
+		file.write("5");
+	}
+}
+
+//Returns the peak resident set size of this process in kilobytes, or -1 if
+//it is not available.
+static inline qint64 peakMemory()
+{
+	QFile file(QLatin1String("/proc/self/status"));
+	if (!file.open(QIODevice::ReadOnly))
+	{
+		return -1;
+	}
+	foreach (const QByteArray& line, file.readAll().split('\n'))
+	{
+		if (line.startsWith("VmHWM:"))
+		{
+			return line.mid(6).trimmed().split(' ').value(0).toLongLong();
+		}
+	}
+	return -1;
+}
+
+#endif // TAGARO_TOOLS_MEMORYUSAGE_H
@@ -0,0 +1,537 @@
+/***************************************************************************
+ *   Copyright 2011 Stefan Majewsky <majewsky@gmx.net>                     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+//This tool measures the performance of the sprite rendering pipeline, so that
+//different versions of the library can be compared. It generates synthetic
+//themes, runs typical workloads on them, and prints the results as JSON.
+//
+//Usage: tagaro-bench [--sprites N] [--frames N] [--size PX] [--cycles N] [--output FILE]
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QTextStream>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
+#include <QtGui/QApplication>
+#include <QtGui/QImage>
+#include <QtGui/QPainter>
+#include <KDE/KComponentData>
+#include <KDE/KTempDir>
+
+#include <Tagaro/GraphicsSourceConfig>
+#include <Tagaro/RenderScheduler>
+#include <Tagaro/Settings>
+#include <Tagaro/SimpleThemeProvider>
+#include <Tagaro/Sprite>
+#include <Tagaro/SpriteClient>
+#include <Tagaro/Theme>
+#include <tagaro/config.h>
+
+#include "memoryusage.h"
+
+//BEGIN parameters and results
+
+struct Parameters
+{
+	int spriteCount; //static sprites
+	int frameCount; //frames of each animated sprite (there are spriteCount / 4 of them)
+	int size; //initial render size (in pixels)
+	int cycles; //repetitions of the resize, animation and theme switch workloads
+	QString outputPath;
+
+	Parameters() : spriteCount(64), frameCount(8), size(64), cycles(3) {}
+};
+
+struct Result
+{
+	QString workload, themeType;
+	bool diskCache, threads;
+	int deliveries, timeouts;
+	qint64 wallTime; //microseconds
+	QVector<qint64> latencies; //microseconds
+	qint64 peakMemory; //kilobytes
+};
+
+//END parameters and results
+//BEGIN measurement
+
+class Benchmark;
+
+//Measures the time from a request (i.e. a change of the render size, frame or
+//theme) to the delivery of a pixmap which matches the current render size.
+class BenchmarkClient : public Tagaro::SpriteClient
+{
+	public:
+		BenchmarkClient(Tagaro::Sprite* sprite, Benchmark* benchmark) : Tagaro::SpriteClient(sprite), m_benchmark(benchmark), m_waiting(false), m_requestTime(0) {}
+		virtual ~BenchmarkClient();
+
+		//Call this before the request is made (the pixmap might be delivered
+		//from within the request).
+		void expectPixmap();
+	protected:
+		virtual void receivePixmap(const QPixmap& pixmap);
+	private:
+		Benchmark* m_benchmark;
+		bool m_waiting;
+		qint64 m_requestTime;
+};
+
+class Benchmark
+{
+	public:
+		Benchmark() : m_pending(0), m_timeouts(0), m_startTime(0) { m_clock.start(); }
+
+		//millisecond resolution (QElapsedTimer::nsecsElapsed() needs Qt 4.8)
+		inline qint64 now() const { return m_clock.elapsed() * 1000; }
+		void begin()
+		{
+			m_latencies.clear();
+			m_timeouts = 0;
+			resetPeakMemory();
+			m_startTime = now();
+		}
+		void expect() { ++m_pending; }
+		void deliver(qint64 latency) { --m_pending; m_latencies << latency; }
+		void forget() { --m_pending; }
+		//Runs the event loop until all expected pixmaps have been delivered.
+		void wait(int timeout = 60000)
+		{
+			//the timer wakes up the event loop regularly
+			QTimer wakeupTimer;
+			wakeupTimer.start(10);
+			const qint64 deadline = now() + qint64(timeout) * 1000;
+			while (m_pending > 0 && now() < deadline)
+			{
+				QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+			}
+			m_timeouts += m_pending;
+			m_pending = 0;
+		}
+		Result end(const QString& workload) const
+		{
+			Result result;
+			result.workload = workload;
+			result.deliveries = m_latencies.count();
+			result.timeouts = m_timeouts;
+			result.wallTime = now() - m_startTime;
+			result.latencies = m_latencies;
+			result.peakMemory = peakMemory();
+			return result;
+		}
+	private:
+		QElapsedTimer m_clock;
+		int m_pending, m_timeouts;
+		qint64 m_startTime;
+		QVector<qint64> m_latencies;
+};
+
+BenchmarkClient::~BenchmarkClient()
+{
+	if (m_waiting)
+	{
+		m_benchmark->forget();
+	}
+}
+
+void BenchmarkClient::expectPixmap()
+{
+	if (!m_waiting)
+	{
+		m_waiting = true;
+		m_benchmark->expect();
+	}
+	m_requestTime = m_benchmark->now();
+}
+
+void BenchmarkClient::receivePixmap(const QPixmap& pixmap)
+{
+	//previous requests (e.g. for an intermediate size) do not count
+	if (m_waiting && pixmap.size() == renderSize())
+	{
+		m_waiting = false;
+		m_benchmark->deliver(m_benchmark->now() - m_requestTime);
+	}
+}
+
+//END measurement
+//BEGIN synthetic themes
+
+static QColor spriteColor(int index, int variant)
+{
+	return QColor::fromHsv((index * 37 + variant * 180) % 360, 200, 220);
+}
+
+//Writes an SVG file with the static sprites "sprite<i>" and the animated
+//sprites "anim<i>_<frame>". The elements use gradients and paths, so that
+//rendering them takes a realistic amount of time.
+static void writeSvgTheme(const QString& path, const Parameters& params, int variant)
+{
+	QFile file(path);
+	file.open(QIODevice::WriteOnly);
+	QTextStream out(&file);
+	out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	    << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"1000\" height=\"1000\">\n<defs>\n";
+	const int animCount = qMax(1, params.spriteCount / 4);
+	for (int i = 0; i < params.spriteCount; ++i)
+	{
+		out << QString::fromLatin1("<radialGradient id=\"g%1\"><stop offset=\"0\" stop-color=\"white\"/><stop offset=\"1\" stop-color=\"%2\"/></radialGradient>\n")
+			.arg(i).arg(spriteColor(i, variant).name());
+	}
+	out << "</defs>\n";
+	for (int i = 0; i < params.spriteCount; ++i)
+	{
+		const int x = (i % 10) * 100, y = (i / 10) * 100;
+		out << QString::fromLatin1("<g id=\"sprite%1\"><circle cx=\"%2\" cy=\"%3\" r=\"48\" fill=\"url(#g%1)\" stroke=\"black\"/>").arg(i).arg(x + 50).arg(y + 50);
+		for (int j = 0; j < 6; ++j)
+		{
+			out << QString::fromLatin1("<path d=\"M %1 %2 q 20 %3 40 0 t 40 0\" fill=\"none\" stroke=\"%4\" stroke-width=\"3\"/>")
+				.arg(x + 10).arg(y + 20 + j * 10).arg(j % 2 ? 15 : -15).arg(spriteColor(i + j, variant).darker().name());
+		}
+		out << "</g>\n";
+	}
+	for (int i = 0; i < animCount; ++i)
+	{
+		for (int f = 0; f < params.frameCount; ++f)
+		{
+			out << QString::fromLatin1("<g id=\"anim%1_%2\" transform=\"rotate(%3 50 50)\"><rect x=\"10\" y=\"10\" width=\"80\" height=\"80\" rx=\"10\" fill=\"url(#g%4)\" stroke=\"black\"/></g>\n")
+				.arg(i).arg(f).arg(f * 360 / params.frameCount).arg(i % params.spriteCount);
+		}
+	}
+	out << "</svg>\n";
+}
+
+//Writes an image containing the same sprites as writeSvgTheme() in a grid of
+//cells, and returns the element definitions for Tagaro::ImageGraphicsSource.
+static QMap<QString, QString> writeRasterTheme(const QString& path, const Parameters& params, int variant)
+{
+	static const int cellSize = 128;
+	const int animCount = qMax(1, params.spriteCount / 4);
+	const int cellCount = params.spriteCount + animCount * params.frameCount;
+	const int columns = 16, rows = (cellCount + columns - 1) / columns;
+	QImage image(columns * cellSize, rows * cellSize, QImage::Format_ARGB32_Premultiplied);
+	image.fill(QColor(Qt::transparent).rgba());
+	QPainter painter(&image);
+	painter.setRenderHint(QPainter::Antialiasing);
+	QMap<QString, QString> elements;
+	for (int cell = 0; cell < cellCount; ++cell)
+	{
+		const QRect rect((cell % columns) * cellSize, (cell / columns) * cellSize, cellSize, cellSize);
+		QString key;
+		if (cell < params.spriteCount)
+		{
+			key = QString::fromLatin1("sprite%1").arg(cell);
+			QRadialGradient gradient(rect.center(), cellSize / 2);
+			gradient.setColorAt(0, Qt::white);
+			gradient.setColorAt(1, spriteColor(cell, variant));
+			painter.setBrush(gradient);
+			painter.drawEllipse(rect.adjusted(4, 4, -4, -4));
+		}
+		else
+		{
+			const int index = cell - params.spriteCount;
+			key = QString::fromLatin1("anim%1_%2").arg(index / params.frameCount).arg(index % params.frameCount);
+			painter.save();
+			painter.translate(rect.center());
+			painter.rotate(index % params.frameCount * 360 / params.frameCount);
+			painter.setBrush(spriteColor(index, variant));
+			painter.drawRoundedRect(-cellSize / 3, -cellSize / 3, cellSize * 2 / 3, cellSize * 2 / 3, 10, 10);
+			painter.restore();
+		}
+		elements.insert(key, QString::fromLatin1("%1x%2+%3+%4").arg(rect.width()).arg(rect.height()).arg(rect.x()).arg(rect.y()));
+	}
+	painter.end();
+	image.save(path);
+	return elements;
+}
+
+//The files of the synthetic themes (two variants of the same set of sprites).
+struct ThemeFiles
+{
+	QStringList paths;
+	QList<QMap<QString, QString> > sourceConfigs;
+};
+
+static ThemeFiles writeThemes(const QString& directory, const QString& themeType, const Parameters& params)
+{
+	ThemeFiles files;
+	for (int variant = 0; variant < 2; ++variant)
+	{
+		if (themeType == QLatin1String("svg"))
+		{
+			files.paths << QString::fromLatin1("%1/theme%2.svg").arg(directory).arg(variant);
+			files.sourceConfigs << QMap<QString, QString>();
+			writeSvgTheme(files.paths.last(), params, variant);
+		}
+		else
+		{
+			files.paths << QString::fromLatin1("%1/theme%2.png").arg(directory).arg(variant);
+			files.sourceConfigs << writeRasterTheme(files.paths.last(), params, variant);
+		}
+	}
+	return files;
+}
+
+static Tagaro::SimpleThemeProvider* createProvider(const ThemeFiles& files)
+{
+	Tagaro::GraphicsSourceConfig config;
+	config.setCacheSize(32);
+	Tagaro::SimpleThemeProvider* provider = new Tagaro::SimpleThemeProvider(0, config);
+	for (int variant = 0; variant < files.paths.count(); ++variant)
+	{
+		Tagaro::Theme* theme = new Tagaro::Theme(QString::fromLatin1("bench%1").arg(variant).toUtf8(), provider);
+		theme->setName(QString::fromLatin1("Variant %1").arg(variant));
+		theme->addSource("default", files.paths[variant], QList<QDir>(), files.sourceConfigs[variant]);
+		theme->addMapping(QRegExp(QLatin1String(".*")), QLatin1String("%0"), theme->source("default"));
+		provider->addTheme(theme);
+	}
+	return provider;
+}
+
+//END synthetic themes
+//BEGIN workloads
+
+static QList<BenchmarkClient*> createClients(Tagaro::ThemeProvider* provider, const QString& prefix, int count, int size, Benchmark* benchmark)
+{
+	QList<BenchmarkClient*> clients;
+	for (int i = 0; i < count; ++i)
+	{
+		BenchmarkClient* client = new BenchmarkClient(provider->sprite(prefix.arg(i)), benchmark);
+		client->expectPixmap();
+		client->setRenderSize(QSize(size, size));
+		clients << client;
+	}
+	return clients;
+}
+
+//Fetches all static sprites from a new provider.
+static Result runStartup(const QString& workload, const ThemeFiles& files, const Parameters& params)
+{
+	Benchmark benchmark;
+	benchmark.begin();
+	Tagaro::SimpleThemeProvider* provider = createProvider(files);
+	QList<BenchmarkClient*> clients = createClients(provider, QLatin1String("sprite%1"), params.spriteCount, params.size, &benchmark);
+	benchmark.wait();
+	const Result result = benchmark.end(workload);
+	qDeleteAll(clients);
+	delete provider;
+	return result;
+}
+
+//Resizes all static sprites several times in a row, and waits for the pixmaps
+//in the final size. (The resize quiet period is disabled, so that every
+//intermediate size is requested and then withdrawn again.)
+static Result runResize(const ThemeFiles& files, const Parameters& params)
+{
+	Benchmark benchmark;
+	Tagaro::SimpleThemeProvider* provider = createProvider(files);
+	QList<BenchmarkClient*> clients = createClients(provider, QLatin1String("sprite%1"), params.spriteCount, params.size, &benchmark);
+	benchmark.wait();
+	benchmark.begin();
+	for (int cycle = 0; cycle < params.cycles; ++cycle)
+	{
+		for (int step = 1; step <= 8; ++step)
+		{
+			const QSize size(params.size + step * 4, params.size + step * 4);
+			foreach (BenchmarkClient* client, clients)
+			{
+				client->setResizeQuietPeriod(0);
+				client->expectPixmap();
+				client->setRenderSize(size);
+			}
+			QCoreApplication::processEvents();
+		}
+		benchmark.wait();
+		//shrink back to the start size (which is still cached)
+		foreach (BenchmarkClient* client, clients)
+		{
+			client->expectPixmap();
+			client->setRenderSize(QSize(params.size, params.size));
+		}
+		benchmark.wait();
+	}
+	const Result result = benchmark.end(QLatin1String("resize"));
+	qDeleteAll(clients);
+	delete provider;
+	return result;
+}
+
+//Steps all animated sprites through their frames.
+static Result runAnimation(const ThemeFiles& files, const Parameters& params)
+{
+	Benchmark benchmark;
+	Tagaro::SimpleThemeProvider* provider = createProvider(files);
+	const int animCount = qMax(1, params.spriteCount / 4);
+	QList<BenchmarkClient*> clients = createClients(provider, QLatin1String("anim%1"), animCount, params.size, &benchmark);
+	benchmark.wait();
+	benchmark.begin();
+	for (int step = 1; step <= params.cycles * params.frameCount; ++step)
+	{
+		foreach (BenchmarkClient* client, clients)
+		{
+			client->expectPixmap();
+			client->setFrame(step);
+		}
+		benchmark.wait();
+	}
+	const Result result = benchmark.end(QLatin1String("animation"));
+	qDeleteAll(clients);
+	delete provider;
+	return result;
+}
+
+//Switches between the two themes repeatedly.
+static Result runThemeSwitch(const ThemeFiles& files, const Parameters& params)
+{
+	Benchmark benchmark;
+	Tagaro::SimpleThemeProvider* provider = createProvider(files);
+	QList<BenchmarkClient*> clients = createClients(provider, QLatin1String("sprite%1"), params.spriteCount, params.size, &benchmark);
+	benchmark.wait();
+	benchmark.begin();
+	const QList<const Tagaro::Theme*> themes = provider->themes();
+	for (int i = 1; i <= params.cycles * 2; ++i)
+	{
+		foreach (BenchmarkClient* client, clients)
+		{
+			client->expectPixmap();
+		}
+		provider->setSelectedTheme(themes[i % 2]);
+		benchmark.wait();
+	}
+	const Result result = benchmark.end(QLatin1String("themeswitch"));
+	qDeleteAll(clients);
+	delete provider;
+	return result;
+}
+
+//END workloads
+//BEGIN output
+
+static QString percentile(const QVector<qint64>& sortedValues, qreal p)
+{
+	if (sortedValues.isEmpty())
+	{
+		return QLatin1String("null");
+	}
+	const int index = qMin(sortedValues.count() - 1, int(p * sortedValues.count()));
+	return QString::number(sortedValues[index] / 1000.0, 'f', 3);
+}
+
+static QString toJson(const Result& result)
+{
+	QVector<qint64> latencies = result.latencies;
+	qSort(latencies);
+	const qreal seconds = result.wallTime / 1000000.0;
+	QString json;
+	QTextStream out(&json);
+	out << "{\"workload\":\"" << result.workload << "\",\"theme\":\"" << result.themeType << '"'
+	    << ",\"diskCache\":" << (result.diskCache ? "true" : "false")
+	    << ",\"threads\":" << (result.threads ? "true" : "false")
+	    << ",\"deliveries\":" << result.deliveries
+	    << ",\"timeouts\":" << result.timeouts
+	    << ",\"wallTime\":" << QString::number(result.wallTime / 1000.0, 'f', 3)
+	    << ",\"throughput\":" << QString::number(seconds > 0 ? result.deliveries / seconds : 0.0, 'f', 1)
+	    << ",\"latency\":{\"p50\":" << percentile(latencies, 0.5)
+	    << ",\"p90\":" << percentile(latencies, 0.9)
+	    << ",\"p99\":" << percentile(latencies, 0.99)
+	    << ",\"max\":" << percentile(latencies, 1.0) << '}'
+	    << ",\"peakMemory\":" << result.peakMemory << '}';
+	out.flush();
+	return json;
+}
+
+//END output
+
+int main(int argc, char** argv)
+{
+	KComponentData componentData("tagaro-bench");
+	QApplication app(argc, argv);
+	//parse arguments
+	Parameters params;
+	const QStringList args = app.arguments();
+	for (int i = 1; i < args.count() - 1; ++i)
+	{
+		const QString& arg = args[i];
+		if (arg == QLatin1String("--sprites"))
+			params.spriteCount = qMax(1, args[++i].toInt());
+		else if (arg == QLatin1String("--frames"))
+			params.frameCount = qMax(2, args[++i].toInt());
+		else if (arg == QLatin1String("--size"))
+			params.size = qMax(1, args[++i].toInt());
+		else if (arg == QLatin1String("--cycles"))
+			params.cycles = qMax(1, args[++i].toInt());
+		else if (arg == QLatin1String("--output"))
+			params.outputPath = args[++i];
+	}
+	//run all workloads with all configurations (The settings are not
+	//written back to the configuration file.)
+	QList<Result> results;
+	const QStringList themeTypes = QStringList() << QLatin1String("svg") << QLatin1String("raster");
+	foreach (const QString& themeType, themeTypes)
+	{
+		for (int configIndex = 0; configIndex < 4; ++configIndex)
+		{
+			const bool diskCache = configIndex & 1, threads = configIndex & 2;
+			Tagaro::Settings::setUseDiskCache(diskCache);
+			Tagaro::Settings::setUseRenderingThreads(threads);
+			//a new directory for each configuration makes sure that the
+			//disk caches are cold at first
+			KTempDir directory;
+			const ThemeFiles files = writeThemes(directory.name(), themeType, params);
+			QList<Result> configResults;
+			configResults << runStartup(QLatin1String("cold"), files, params);
+			configResults << runStartup(QLatin1String("warm"), files, params);
+			configResults << runResize(files, params);
+			configResults << runAnimation(files, params);
+			configResults << runThemeSwitch(files, params);
+			for (int i = 0; i < configResults.count(); ++i)
+			{
+				configResults[i].themeType = themeType;
+				configResults[i].diskCache = diskCache;
+				configResults[i].threads = threads;
+			}
+			results += configResults;
+		}
+	}
+	//write results
+	QFile file;
+	if (params.outputPath.isEmpty())
+	{
+		file.open(stdout, QIODevice::WriteOnly);
+	}
+	else
+	{
+		file.setFileName(params.outputPath);
+		if (!file.open(QIODevice::WriteOnly))
+		{
+			qWarning("Cannot write to %s", qPrintable(params.outputPath));
+			return 1;
+		}
+	}
+	QTextStream out(&file);
+	out << "{\"version\":\"" << TAGARO_VERSION_STRING << '"'
+	    << ",\"parameters\":{\"sprites\":" << params.spriteCount << ",\"frames\":" << params.frameCount
+	    << ",\"size\":" << params.size << ",\"cycles\":" << params.cycles
+	    << ",\"renderingThreads\":" << Tagaro::RenderScheduler::threadCount() << '}'
+	    << ",\"results\":[\n";
+	for (int i = 0; i < results.count(); ++i)
+	{
+		out << toJson(results[i]) << (i + 1 < results.count() ? ",\n" : "\n");
+	}
+	out << "]}\n";
+	return 0;
+}
@@ -0,0 +1,357 @@
+/***************************************************************************
+ *   Copyright 2011 Stefan Majewsky <majewsky@gmx.net>                     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+//This tool replays a log of rendering requests, which has been recorded by
+//setting the TAGARO_RECORD_FILE environment variable while running an
+//application. The requests are fed through the rendering pipeline back-to-back
+//in the order of the log, so that requests can still withdraw, deduplicate or
+//cancel the rendering jobs of earlier requests. The pipeline is only drained
+//at the end of the log. By default, the rendering scheduler runs in its
+//deterministic mode, so that the results are reproducible: After each
+//request, a fixed number of rendering jobs is executed (one unless the
+//--jobs-per-event option is given). The measurements are printed as JSON.
+//
+//Usage: tagaro-replay [--threaded] [--no-disk-cache] [--repeat N] [--jobs-per-event N] LOGFILE THEMEFILE...
+//
+//The theme files are the .desktop files of the themes which were used while
+//recording. Theme switches in the log are mapped to these files by their
+//identifiers, or by their file names, or else in order of appearance.
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QHash>
+#include <QtCore/QTextStream>
+#include <QtCore/QUrl>
+#include <QtGui/QApplication>
+#include <KDE/KComponentData>
+
+#include <Tagaro/RenderScheduler>
+#include <Tagaro/Settings>
+#include <Tagaro/SimpleThemeProvider>
+#include <Tagaro/Sprite>
+#include <Tagaro/SpriteClient>
+#include <Tagaro/StandardTheme>
+
+#include "memoryusage.h"
+
+static int g_deliveries = 0;
+
+class ReplayClient : public Tagaro::SpriteClient
+{
+	public:
+		ReplayClient(Tagaro::Sprite* sprite) : Tagaro::SpriteClient(sprite)
+		{
+			//The resize debouncer depends on the wall clock, which would make
+			//the replay non-deterministic.
+			setResizeQuietPeriod(0);
+		}
+	protected:
+		virtual void receivePixmap(const QPixmap& pixmap)
+		{
+			Q_UNUSED(pixmap)
+			++g_deliveries;
+		}
+		virtual void receiveImage(const QImage& image)
+		{
+			Q_UNUSED(image)
+			++g_deliveries;
+		}
+};
+
+static QString decode(const QByteArray& string)
+{
+	return string == "-" ? QString() : QUrl::fromPercentEncoding(string);
+}
+
+//Runs the pipeline until neither rendering jobs nor events are pending.
+static void settle()
+{
+	int idleRounds = 0;
+	while (idleRounds < 2)
+	{
+		int jobs = 0;
+		if (Tagaro::RenderScheduler::isDeterministic())
+		{
+			jobs = Tagaro::RenderScheduler::processPendingJobs();
+		}
+		else
+		{
+			const Tagaro::RenderScheduler::Statistics stats = Tagaro::RenderScheduler::statistics();
+			jobs = stats.runningJobs;
+			for (int p = 0; p < Tagaro::RenderScheduler::PriorityCount; ++p)
+			{
+				jobs += stats.queueDepth[p];
+			}
+		}
+		QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+		const bool idle = jobs == 0 && !QCoreApplication::hasPendingEvents();
+		idleRounds = idle ? idleRounds + 1 : 0;
+	}
+}
+
+//Lets the pipeline progress between two requests: In deterministic mode, up
+//to the given number of rendering jobs is executed. Events are processed
+//without waiting for new ones (e.g. to deliver finished jobs).
+static void step(int jobs)
+{
+	if (Tagaro::RenderScheduler::isDeterministic())
+	{
+		Tagaro::RenderScheduler::processPendingJobs(jobs);
+	}
+	QCoreApplication::processEvents();
+}
+
+class Replay
+{
+	public:
+		Replay(const QStringList& themePaths);
+		~Replay();
+		//Returns false if the line could not be parsed.
+		bool execute(const QByteArray& line);
+	private:
+		ReplayClient* client(const QByteArray& id);
+		Tagaro::Sprite* sprite(const QByteArray& key);
+		const Tagaro::Theme* theme(const QString& identifier);
+
+		Tagaro::SimpleThemeProvider m_provider;
+		QHash<QByteArray, ReplayClient*> m_clients;
+		QHash<QString, const Tagaro::Theme*> m_themeMap;
+};
+
+Replay::Replay(const QStringList& themePaths)
+{
+	foreach (const QString& path, themePaths)
+	{
+		m_provider.addTheme(new Tagaro::StandardTheme(path, &m_provider));
+	}
+}
+
+Replay::~Replay()
+{
+	qDeleteAll(m_clients);
+}
+
+ReplayClient* Replay::client(const QByteArray& id)
+{
+	//the log might start after the creation of some clients
+	ReplayClient*& client = m_clients[id];
+	if (!client)
+	{
+		client = new ReplayClient(0);
+	}
+	return client;
+}
+
+Tagaro::Sprite* Replay::sprite(const QByteArray& key)
+{
+	const QString spriteKey = decode(key);
+	return spriteKey.isEmpty() ? 0 : m_provider.sprite(spriteKey);
+}
+
+const Tagaro::Theme* Replay::theme(const QString& identifier)
+{
+	QHash<QString, const Tagaro::Theme*>::const_iterator it = m_themeMap.constFind(identifier);
+	if (it != m_themeMap.constEnd())
+	{
+		return it.value();
+	}
+	const QList<const Tagaro::Theme*> themes = m_provider.themes();
+	const Tagaro::Theme* result = 0;
+	foreach (const Tagaro::Theme* theme, themes)
+	{
+		if (QString::fromUtf8(theme->identifier()) == identifier)
+		{
+			result = theme;
+		}
+	}
+	const QString fileName = QFileInfo(identifier).fileName();
+	foreach (const Tagaro::Theme* theme, themes)
+	{
+		if (!result && QFileInfo(QString::fromUtf8(theme->identifier())).fileName() == fileName)
+		{
+			result = theme;
+		}
+	}
+	if (!result && !themes.isEmpty())
+	{
+		result = themes[m_themeMap.count() % themes.count()];
+	}
+	m_themeMap.insert(identifier, result);
+	return result;
+}
+
+bool Replay::execute(const QByteArray& line)
+{
+	const QList<QByteArray> fields = line.trimmed().split(' ');
+	if (fields.count() < 2)
+	{
+		return false;
+	}
+	const QByteArray& command = fields[1];
+	const QList<QByteArray> args = fields.mid(2);
+	if (command == "create" && args.count() == 2)
+	{
+		delete m_clients.take(args[0]);
+		m_clients.insert(args[0], new ReplayClient(sprite(args[1])));
+	}
+	else if (command == "destroy" && args.count() == 1)
+	{
+		delete m_clients.take(args[0]);
+	}
+	else if (command == "sprite" && args.count() == 2)
+	{
+		client(args[0])->setSprite(sprite(args[1]));
+	}
+	else if (command == "size" && args.count() == 3)
+	{
+		client(args[0])->setRenderSize(QSize(args[1].toInt(), args[2].toInt()));
+	}
+	else if (command == "frame" && args.count() == 2)
+	{
+		client(args[0])->setFrame(args[1].toInt());
+	}
+	else if (command == "pi" && args.count() == 2)
+	{
+		client(args[0])->setProcessingInstruction(decode(args[1]));
+	}
+	else if (command == "priority" && args.count() == 2)
+	{
+		const int priority = qBound(0, args[1].toInt(), int(Tagaro::RenderScheduler::PriorityCount) - 1);
+		client(args[0])->setRenderPriority(Tagaro::RenderScheduler::Priority(priority));
+	}
+	else if (command == "delivery" && args.count() == 2)
+	{
+		client(args[0])->setDeliveryMode(args[1].toInt() ? Tagaro::SpriteClient::ImageDelivery : Tagaro::SpriteClient::PixmapDelivery);
+	}
+	else if (command == "pixmap" && args.count() == 5)
+	{
+		Tagaro::Sprite* s = sprite(args[0]);
+		if (s)
+		{
+			s->pixmap(QSize(args[1].toInt(), args[2].toInt()), args[3].toInt(), decode(args[4]));
+		}
+	}
+	else if (command == "theme" && args.count() == 1)
+	{
+		const Tagaro::Theme* t = theme(decode(args[0]));
+		if (t)
+		{
+			m_provider.setSelectedTheme(t);
+		}
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	KComponentData componentData("tagaro-replay");
+	QApplication app(argc, argv);
+	//parse arguments
+	bool threaded = false, diskCache = Tagaro::Settings::useDiskCache();
+	int repeat = 1, jobsPerEvent = 1;
+	QStringList paths;
+	const QStringList args = app.arguments();
+	for (int i = 1; i < args.count(); ++i)
+	{
+		if (args[i] == QLatin1String("--threaded"))
+			threaded = true;
+		else if (args[i] == QLatin1String("--no-disk-cache"))
+			diskCache = false;
+		else if (args[i] == QLatin1String("--repeat") && i + 1 < args.count())
+			repeat = qMax(1, args[++i].toInt());
+		else if (args[i] == QLatin1String("--jobs-per-event") && i + 1 < args.count())
+			jobsPerEvent = qMax(1, args[++i].toInt());
+		else
+			paths << args[i];
+	}
+	if (paths.count() < 2)
+	{
+		qWarning("Usage: tagaro-replay [--threaded] [--no-disk-cache] [--repeat N] [--jobs-per-event N] LOGFILE THEMEFILE...");
+		return 1;
+	}
+	QFile logFile(paths.takeFirst());
+	if (!logFile.open(QIODevice::ReadOnly))
+	{
+		qWarning("Cannot read %s", qPrintable(logFile.fileName()));
+		return 1;
+	}
+	const QList<QByteArray> lines = logFile.readAll().split('\n');
+	//configure the pipeline (The settings are not written back to the
+	//configuration file.) The time budgets are disabled because they depend
+	//on the wall clock.
+	Tagaro::Settings::setUseDiskCache(diskCache);
+	Tagaro::Settings::setUseRenderingThreads(true);
+	Tagaro::Settings::setDeliveryTimeBudget(0);
+	Tagaro::Settings::setConversionTimeBudget(0);
+	Tagaro::RenderScheduler::setDeterministic(!threaded);
+	//replay
+	QTextStream out(stdout);
+	out << "{\"log\":\"" << QFileInfo(logFile).fileName() << "\",\"deterministic\":" << (threaded ? "false" : "true")
+	    << ",\"diskCache\":" << (diskCache ? "true" : "false");
+	if (!threaded)
+	{
+		out << ",\"jobsPerEvent\":" << jobsPerEvent;
+	}
+	out << ",\"runs\":[\n";
+	for (int run = 0; run < repeat; ++run)
+	{
+		g_deliveries = 0;
+		resetPeakMemory();
+		int events = 0, invalidLines = 0;
+		const Tagaro::RenderScheduler::Statistics statsBefore = Tagaro::RenderScheduler::statistics();
+		QElapsedTimer clock;
+		clock.start();
+		{
+			Replay replay(paths);
+			settle();
+			foreach (const QByteArray& line, lines)
+			{
+				if (line.trimmed().isEmpty() || line.startsWith('#'))
+				{
+					continue;
+				}
+				if (replay.execute(line))
+				{
+					++events;
+				}
+				else
+				{
+					++invalidLines;
+				}
+				step(jobsPerEvent);
+			}
+			settle();
+		}
+		//QElapsedTimer::nsecsElapsed() needs Qt 4.8
+		const qint64 wallTime = clock.elapsed() * 1000;
+		const Tagaro::RenderScheduler::Statistics stats = Tagaro::RenderScheduler::statistics();
+		out << "{\"events\":" << events << ",\"invalidLines\":" << invalidLines
+		    << ",\"wallTime\":" << QString::number(wallTime / 1000.0, 'f', 3)
+		    << ",\"deliveries\":" << g_deliveries
+		    << ",\"finishedJobs\":" << (stats.finishedJobs - statsBefore.finishedJobs)
+		    << ",\"cancelledJobs\":" << (stats.cancelledJobs - statsBefore.cancelledJobs)
+		    << ",\"peakMemory\":" << peakMemory() << '}' << (run + 1 < repeat ? ",\n" : "\n");
+	}
+	out << "]}\n";
+	return 0;
+}